@@ -6,10 +6,359 @@
 #include <stack>
 #include <iostream>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <utility>
+#include <numeric>
+#include <limits>
 #include <algorithm>
 
 namespace graph
 {
+
+class CSRGraph
+{
+public:
+    // Compressed Sparse Row graph
+    //
+    // The neighbors of @v are targets()[offsets()[v] .. offsets()[v + 1]),
+    // all of them in one array: a traversal walks memory in order instead
+    // of chasing one heap block per vertex.
+    // Space: O(V + E)
+    //
+    // Immutable once built. Works as either graph_t of the algorithms below.
+    class adj_iter_t
+    {
+    public:
+        adj_iter_t(const int* begin, const int* end)
+            : _begin(begin), _end(end) { }
+
+        inline const int* begin() const { return _begin; }
+        inline const int* end() const { return _end; }
+        inline std::size_t size() const { return _end - _begin; }
+        inline bool empty() const { return _begin == _end; }
+        inline int operator[](std::size_t i) const { return _begin[i]; }
+
+    private:
+        const int* _begin;
+        const int* _end;
+    };
+
+    typedef std::pair<int, int> edge_t;
+
+    CSRGraph() : _V(0), _E(0), _offsets(1, 0) { }
+
+    // Converts an adjacency-list graph (UGraph, DGraph), keeping the order
+    // of every neighbor list.
+    //
+    // Time complexity: O(|V| + |E|)
+    template <typename G>
+    explicit CSRGraph(const G& graph)
+        : _V(graph.V()), _E(graph.E()), _offsets(graph.V() + 1, 0)
+    {
+        for (int v = 0; v < _V; ++v)
+            _offsets[v + 1] = _offsets[v] + graph.adjacent(v).size();
+
+        _targets.reserve(_offsets[_V]);
+        for (int v = 0; v < _V; ++v)
+        {
+            const auto& adj = graph.adjacent(v);
+            _targets.insert(_targets.end(), adj.begin(), adj.end());
+        }
+    }
+
+    // Builds a graph on vertices [0, V) by counting sort on the sources.
+    // An undirected edge is stored in both directions. Neighbors keep the
+    // order of @edges, whose count must fit E()'s int like UGraph/DGraph's.
+    //
+    // Time complexity: O(|V| + |E|)
+    static CSRGraph from_edges(int V, const std::vector<edge_t>& edges,
+                               bool directed)
+    {
+        assert(edges.size() <= std::size_t(std::numeric_limits<int>::max()));
+        CSRGraph result;
+        result._V = V;
+        result._E = int(edges.size());
+        result._offsets.assign(V + 1, 0);
+
+        for (const edge_t& e : edges)
+        {
+            ++result._offsets[e.first + 1];
+            if (!directed)
+                ++result._offsets[e.second + 1];
+        }
+        for (int v = 0; v < V; ++v)
+            result._offsets[v + 1] += result._offsets[v];
+
+        std::vector<std::size_t> cursor(result._offsets.begin(),
+                                        result._offsets.end() - 1);
+        result._targets.resize(result._offsets[V]);
+        for (const edge_t& e : edges)
+        {
+            result._targets[cursor[e.first]++] = e.second;
+            if (!directed)
+                result._targets[cursor[e.second]++] = e.first;
+        }
+        return result;
+    }
+
+    inline int V() const { return _V; }
+    inline int E() const { return _E; }
+
+    inline adj_iter_t adjacent(int v) const
+    {
+        const int* base = _targets.data();
+        return adj_iter_t(base + _offsets[v], base + _offsets[v + 1]);
+    }
+
+    inline int degree(int v) const { return _offsets[v + 1] - _offsets[v]; }
+
+    inline const std::vector<std::size_t>& offsets() const { return _offsets; }
+    inline const std::vector<int>& targets() const { return _targets; }
+
+private:
+    int _V;
+    int _E;
+    std::vector<std::size_t> _offsets;  // size V + 1
+    std::vector<int> _targets;          // size offsets[V]
+};
+
+class Bitset
+{
+public:
+    // Word-packed set of vertices, used for visitation marks
+    //
+    // Space: O(V / 64)
+    Bitset(int n = 0) : _n(n), _words((n + 63) / 64, 0) { }
+
+    inline int size() const { return _n; }
+
+    inline bool test(int i) const { return (_words[i >> 6] >> (i & 63)) & 1; }
+    inline void set(int i) { _words[i >> 6] |= std::uint64_t(1) << (i & 63); }
+    inline void reset(int i) { _words[i >> 6] &= ~(std::uint64_t(1) << (i & 63)); }
+    inline void clear() { std::fill(_words.begin(), _words.end(), 0); }
+
+    // Marks 64 * k .. 64 * k + 63
+    inline std::uint64_t word(std::size_t k) const { return _words[k]; }
+
+    // The first unset index >= @from, or size() if there is none. Skips 64
+    // set marks at a time.
+    int next_unset(int from) const
+    {
+        if (from >= _n) return _n;
+
+        std::size_t k = from >> 6;
+        std::uint64_t word = ~_words[k] & (~std::uint64_t(0) << (from & 63));
+        while (word == 0)
+        {
+            if (++k == _words.size()) return _n;
+            word = ~_words[k];
+        }
+        int i = k * 64 + __builtin_ctzll(word);
+        return std::min(i, _n);
+    }
+
+private:
+    int _n;
+    std::vector<std::uint64_t> _words;
+};
+
+class AtomicBitset
+{
+public:
+    // Bitset that several threads may set concurrently
+    //
+    // Space: O(V / 64)
+    AtomicBitset(int n = 0) : _n(n), _words((n + 63) / 64) { }
+
+    inline int size() const { return _n; }
+
+    inline bool test(int i) const
+    {
+        return (word(i >> 6) >> (i & 63)) & 1;
+    }
+
+    // Returns true if this call is the one that set @i.
+    inline bool set(int i)
+    {
+        std::uint64_t bit = std::uint64_t(1) << (i & 63);
+        if (word(i >> 6) & bit) return false;
+        return !(_words[i >> 6].fetch_or(bit, std::memory_order_relaxed) & bit);
+    }
+
+    inline std::uint64_t word(std::size_t k) const
+    {
+        return _words[k].load(std::memory_order_relaxed);
+    }
+
+private:
+    int _n;
+    std::vector<std::atomic<std::uint64_t>> _words;
+};
+
+inline int default_num_threads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Splits [0, n) into at most @num_threads contiguous chunks of at least
+// @grain items, each a multiple of 64 long but the last, and runs
+// fn(t, begin, end) for the t-th chunk on its own thread (the first one on
+// the calling thread). Chunks never share a word of a Bitset. If any fn
+// throws, every chunk is still joined and then the first exception (by
+// chunk) is rethrown.
+//
+// Users of the parallel algorithms must link with -pthread.
+template <typename F>
+void parallel_chunks(int num_threads, std::size_t n, std::size_t grain, F fn)
+{
+    std::size_t num_chunks = std::max<std::size_t>(
+        1, std::min<std::size_t>(num_threads, n / std::max<std::size_t>(grain, 1)));
+    std::size_t chunk = ((n + num_chunks - 1) / num_chunks + 63) / 64 * 64;
+
+    std::vector<std::exception_ptr> errors(num_chunks);
+    auto run = [&errors](F& f, std::size_t t, std::size_t begin, std::size_t end)
+    {
+        try
+        {
+            f(int(t), begin, end);
+        }
+        catch (...)
+        {
+            errors[t] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try
+    {
+        for (std::size_t t = 1; t < num_chunks && t * chunk < n; ++t)
+        {
+            threads.emplace_back([run, fn, t, chunk, n]() mutable
+                                 { run(fn, t, t * chunk, std::min(n, (t + 1) * chunk)); });
+        }
+    }
+    catch (...)
+    {
+        // Could not start a thread; let the started ones finish first.
+        for (std::thread& thread : threads)
+            thread.join();
+        throw;
+    }
+    run(fn, 0, 0, std::min(n, chunk));
+
+    for (std::thread& thread : threads)
+        thread.join();
+    for (std::exception_ptr& error : errors)
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+struct DFSVisitor
+{
+    // Hooks called by DFSEngine; derive and hide the ones you need.
+    //
+    // pre(v) when @v is first reached, post(v) when all of its neighbors are
+    // done, tree_edge(v, w) right before descending from @v into @w, and
+    // non_tree_edge(v, w) for a neighbor @w that was already marked. The
+    // search stops early if non_tree_edge() returns false.
+    inline void pre(int) { }
+    inline void post(int) { }
+    inline void tree_edge(int, int) { }
+    inline bool non_tree_edge(int, int) { return true; }
+};
+
+template <typename G>
+class DFSEngine
+{
+public:
+    // Iterative depth-first search
+    //
+    // Keeps an explicit stack of (vertex, neighbor cursor) frames on the
+    // heap, so the depth of the search is not bounded by the thread stack.
+    // Visits vertices and edges in the same order as the recursive version.
+    //
+    // G::adjacent(v) must return a range that outlives the call, i.e. a
+    // reference to the neighbor list or a view into the graph.
+    //
+    // Time complexity: O(|V| + |E|)
+    typedef G graph_t;
+
+    // Searches from @src, which must not be marked yet, marking everything
+    // reachable from it through unmarked vertices in @marked. Returns false
+    // if @visitor stopped the search.
+    template <typename Visitor>
+    bool run(const graph_t& graph, int src, Bitset& marked, Visitor& visitor)
+    {
+        _stack.clear();
+        enter(graph, src, marked, visitor);
+
+        while (!_stack.empty())
+        {
+            _Frame& top = _stack.back();
+            if (top.cur == top.end)
+            {
+                int v = top.v;
+                _stack.pop_back();
+                visitor.post(v);
+                continue;
+            }
+
+            int v = top.v;
+            int w = *top.cur++;
+            if (!marked.test(w))
+            {
+                visitor.tree_edge(v, w);
+                enter(graph, w, marked, visitor);
+            }
+            else if (!visitor.non_tree_edge(v, w))
+            {
+                _stack.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Searches from every vertex not marked yet, in increasing order.
+    template <typename Visitor>
+    bool run_all(const graph_t& graph, Bitset& marked, Visitor& visitor)
+    {
+        for (int s = marked.next_unset(0); s < graph.V();
+             s = marked.next_unset(s + 1))
+        {
+            if (!run(graph, s, marked, visitor)) return false;
+        }
+        return true;
+    }
+
+private:
+    typedef decltype(std::declval<const G&>().adjacent(0).begin()) _cursor_t;
+
+    struct _Frame
+    {
+        int v;
+        _cursor_t cur;
+        _cursor_t end;
+    };
+
+    template <typename Visitor>
+    void enter(const graph_t& graph, int v, Bitset& marked, Visitor& visitor)
+    {
+        marked.set(v);
+        visitor.pre(v);
+        const auto& adj = graph.adjacent(v);
+        _stack.push_back(_Frame{v, adj.begin(), adj.end()});
+    }
+
+    std::vector<_Frame> _stack;
+};
 namespace undirected
 {
 
@@ -53,18 +402,20 @@ public:
 
     typedef UGraph graph_t;
     
-    void search(const graph_t& graph)
+    template <typename G = graph_t>
+    void search(const G& graph)
     {
         _count = 0;
         _ids = std::vector<int>(graph.V(), -1);
 
-        for (int v = 0; v < graph.V(); ++v)
+        Bitset marked(graph.V());
+        DFSEngine<G> engine;
+        Visitor visitor{this};
+        for (int v = marked.next_unset(0); v < graph.V();
+             v = marked.next_unset(v + 1))
         {
-            if (_ids[v] == -1)
-            {
-                dfs(graph, v);
-                ++_count;
-            }
+            engine.run(graph, v, marked, visitor);
+            ++_count;
         }
     }
 
@@ -77,61 +428,201 @@ public:
     int num_cc() const { return _count; }
 
 private:
-    void dfs(const graph_t& graph, int v)
+    struct Visitor : DFSVisitor
     {
-        _ids[v] = _count;
-        for (int w : graph.adjacent(v))
-        {
-            if (_ids[w] == -1)
-                dfs(graph, w);
-        }
-    }
+        ConnectedComponents* self;
+
+        Visitor(ConnectedComponents* self) : self(self) { }
+        void pre(int v) { self->_ids[v] = self->_count; }
+    };
 
     int _count;
     std::vector<int> _ids;
 };
 
-class UCycle
+class ParallelConnectedComponents
 {
 public:
+    // Multi-threaded, lock-free union-find
+    //
+    // Threads take the edges of disjoint vertex ranges and link the root of
+    // one end under the root of the other with a CAS, always the larger
+    // index under the smaller, so every root is the smallest vertex of its
+    // tree; finds halve their paths as they go. Components are then numbered
+    // in order of their smallest vertex, which gives the very ids
+    // ConnectedComponents does.
+    //
+    // Time complexity: O(|E| α(|V|)) work, in practice
+    //
+    // Suitable for undirected graph
+
     typedef UGraph graph_t;
 
-    void search(const graph_t& graph)
+    ParallelConnectedComponents(int num_threads = 0)
+        : _num_threads(num_threads > 0 ? num_threads : default_num_threads())
+    { }
+
+    template <typename G = graph_t>
+    void search(const G& graph)
     {
-        _has_cycle = false;
-        _marked = std::vector<bool>(graph.V(), false);
+        const int n = graph.V();
+        _parent = std::vector<std::atomic<int>>(n);
+        _ids = std::vector<int>(n);
 
-        for (int s = 0; s < graph.V(); ++s)
+        parallel_chunks(_num_threads, n, _GRAIN,
+                        [&](int, std::size_t begin, std::size_t end)
         {
-            if (!_marked[s])
-                dfs(graph, s, s);
+            for (std::size_t v = begin; v < end; ++v)
+                _parent[v].store(v, std::memory_order_relaxed);
+        });
 
-            if (_has_cycle) return;
-        }
+        // Every edge is listed at both ends; one of them is enough.
+        parallel_chunks(_num_threads, n, _GRAIN,
+                        [&](int, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                for (int w : graph.adjacent(v))
+                {
+                    if (std::size_t(w) < v)
+                        unite(v, w);
+                }
+            }
+        });
+
+        // Roots are numbered per chunk, then offset by the earlier chunks'.
+        std::vector<int> roots(_num_threads, 0);
+        parallel_chunks(_num_threads, n, _GRAIN,
+                        [&](int t, std::size_t begin, std::size_t end)
+        {
+            int count = 0;
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                int root = find(v);
+                _parent[v].store(root, std::memory_order_relaxed);
+                _ids[v] = root == int(v) ? count++ : -1;
+            }
+            roots[t] = count;
+        });
+
+        std::vector<int> base(_num_threads, 0);
+        for (int t = 1; t < _num_threads; ++t)
+            base[t] = base[t - 1] + roots[t - 1];
+        _count = base[_num_threads - 1] + roots[_num_threads - 1];
+
+        parallel_chunks(_num_threads, n, _GRAIN,
+                        [&](int t, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                if (_ids[v] != -1)
+                    _ids[v] += base[t];
+            }
+        });
+
+        // A root precedes its tree's other vertices, but maybe in another
+        // chunk, so its id is only final now.
+        parallel_chunks(_num_threads, n, _GRAIN,
+                        [&](int, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                int root = _parent[v].load(std::memory_order_relaxed);
+                if (root != int(v))
+                    _ids[v] = _ids[root];
+            }
+        });
+
+        _parent = std::vector<std::atomic<int>>();
     }
 
-    bool has_cycle() const { return _has_cycle; }
+    bool connected(int v, int w) const 
+    {
+        return _ids[v] == _ids[w];
+    }
+
+    int id(int v) const { return _ids[v]; }
+    int num_cc() const { return _count; }
 
 private:
-    void dfs(const graph_t& graph, int v, int p)
-    {
-        // @p is the predecessor of @v
-        _marked[v] = true;
+    constexpr static std::size_t _GRAIN = 4096;
 
-        for (int w : graph.adjacent(v))
+    int find(int v)
+    {
+        int p = _parent[v].load(std::memory_order_relaxed);
+        while (p != v)
         {
-            if (!_marked[w])
-                dfs(graph, w, v);
-            else if (w != p)
+            int gp = _parent[p].load(std::memory_order_relaxed);
+            if (gp != p)
             {
-                _has_cycle = true;
-                return;
+                // Halving: @v skips @p. Fails harmlessly if @v moved.
+                _parent[v].compare_exchange_weak(p, gp,
+                                                 std::memory_order_relaxed);
             }
+            v = gp;
+            p = _parent[v].load(std::memory_order_relaxed);
+        }
+        return v;
+    }
+
+    void unite(int v, int w)
+    {
+        while (true)
+        {
+            v = find(v);
+            w = find(w);
+            if (v == w) return;
+            if (v < w) std::swap(v, w);
+
+            // Still a root? Then hang it under the smaller one.
+            int expected = v;
+            if (_parent[v].compare_exchange_strong(expected, w,
+                                                   std::memory_order_relaxed))
+                return;
         }
     }
 
+    int _num_threads;
+    int _count;
+    std::vector<int> _ids;
+    std::vector<std::atomic<int>> _parent;
+};
+
+class UCycle
+{
+public:
+    typedef UGraph graph_t;
+
+    template <typename G = graph_t>
+    void search(const G& graph)
+    {
+        _marked = Bitset(graph.V());
+        // A root is its own predecessor.
+        _parent = std::vector<int>(graph.V());
+        std::iota(_parent.begin(), _parent.end(), 0);
+
+        DFSEngine<G> engine;
+        Visitor visitor{this};
+        _has_cycle = !engine.run_all(graph, _marked, visitor);
+    }
+
+    bool has_cycle() const { return _has_cycle; }
+
+private:
+    struct Visitor : DFSVisitor
+    {
+        UCycle* self;
+
+        Visitor(UCycle* self) : self(self) { }
+        void tree_edge(int v, int w) { self->_parent[w] = v; }
+
+        // Any marked neighbor other than the predecessor closes a cycle.
+        bool non_tree_edge(int v, int w) { return w == self->_parent[v]; }
+    };
+
     bool _has_cycle;
-    std::vector<bool> _marked;
+    Bitset _marked;
+    std::vector<int> _parent;  // the predecessor of each vertex
 };
 
 }; // namespace graph::undirected
@@ -158,12 +649,26 @@ public:
 
     DGraph reverse() const
     {
+        // A counting pass sizes every list up front; they are then filled
+        // in place, in the order add_edge() would have produced.
         DGraph result(_V);
+        std::vector<int> cursor(_V, 0);
         for (int v = 0; v < _V; ++v)
         {
             for (int w : adjacent(v))
-                result.add_edge(w, v);
+                ++cursor[w];
         }
+        for (int w = 0; w < _V; ++w)
+        {
+            result._adj_list[w].resize(cursor[w]);
+            cursor[w] = 0;
+        }
+        for (int v = 0; v < _V; ++v)
+        {
+            for (int w : adjacent(v))
+                result._adj_list[w][cursor[w]++] = v;
+        }
+        result._E = _E;
         return result;
     }
 private:
@@ -175,49 +680,37 @@ private:
 
 class DCycle
 {
-private:
-    constexpr static int _UNMARKED = 0;
-    constexpr static int _ON_STACK = 1;
-    constexpr static int _MARKED = 2;
-
 public:
     typedef DGraph graph_t;
 
-    void search(const graph_t& graph)
+    template <typename G = graph_t>
+    void search(const G& graph)
     {
-        _has_cycle = false;
-        _status = std::vector<int>(graph.V(), _UNMARKED);
-
-        for (int v = 0; v < graph.V(); ++v)
-        {
-            if (_status[v] == _UNMARKED)
-                dfs(graph, v);
+        _marked = Bitset(graph.V());
+        _done = Bitset(graph.V());
 
-            if (_has_cycle) return;       
-        }
+        DFSEngine<G> engine;
+        Visitor visitor{this};
+        _has_cycle = !engine.run_all(graph, _marked, visitor);
     }
 
     bool has_cycle() const { return _has_cycle; }
 
 private:
-    void dfs(const graph_t& graph, int v)
+    struct Visitor : DFSVisitor
     {
-        _status[v] = _ON_STACK;
-        for (int w : graph.adjacent(v))
-        {
-            if (_status[w] == _UNMARKED)
-                dfs(graph, w);
-            else if (_status[w] == _ON_STACK)
-            {
-                _has_cycle = true;
-                return;
-            }
-        }
-        _status[v] = _MARKED;
-    }
+        DCycle* self;
+
+        Visitor(DCycle* self) : self(self) { }
+        void post(int v) { self->_done.set(v); }
+
+        // A marked vertex that is not done yet is on the stack.
+        bool non_tree_edge(int, int w) { return self->_done.test(w); }
+    };
 
     bool _has_cycle;
-    std::vector<int> _status;
+    Bitset _marked;
+    Bitset _done;
 };
 
 class TopologicalSort
@@ -229,9 +722,9 @@ public:
     //
     // Time complexity: O(|V| + |E|)
     
-    result_t sort(const graph_t& graph) 
+    template <typename G = graph_t>
+    result_t sort(const G& graph)
     {
-        _marked = std::vector<bool>(graph.V(), false);
         _result = result_t();
 
         DCycle dc;
@@ -239,31 +732,460 @@ public:
         
         if (!dc.has_cycle())
         {
-            for (int v = 0; v < graph.V(); ++v)
+            Bitset marked(graph.V());
+            DFSEngine<G> engine;
+            Visitor visitor{this};
+            engine.run_all(graph, marked, visitor);
+        }
+
+        return _result;
+    }
+
+private:
+    struct Visitor : DFSVisitor
+    {
+        TopologicalSort* self;
+
+        Visitor(TopologicalSort* self) : self(self) { }
+        void post(int v) { self->_result.push(v); }
+    };
+
+    result_t _result;
+};
+
+// The DAG of the strongly connected components in @ids (numbered from 0 to
+// @count): an edge c -> d whenever some edge of @graph leads from
+// component c to component d, each pair once.
+//
+// Time complexity: O(|V| + |E|)
+template <typename G>
+DGraph build_condensation(const G& graph, const std::vector<int>& ids,
+                          int count)
+{
+    // Counting sort of the vertices by component
+    std::vector<int> start(count + 1, 0);
+    for (int v = 0; v < graph.V(); ++v)
+        ++start[ids[v] + 1];
+    for (int c = 0; c < count; ++c)
+        start[c + 1] += start[c];
+
+    std::vector<int> members(graph.V());
+    std::vector<int> cursor(start.begin(), start.end() - 1);
+    for (int v = 0; v < graph.V(); ++v)
+        members[cursor[ids[v]]++] = v;
+
+    DGraph result(count);
+    std::vector<int> last(count, -1);  // the last component linked to each
+    for (int c = 0; c < count; ++c)
+    {
+        for (int i = start[c]; i < start[c + 1]; ++i)
+        {
+            for (int w : graph.adjacent(members[i]))
             {
-                if (!_marked[v])
-                    dfs(graph, v);
+                int d = ids[w];
+                if (d != c && last[d] != c)
+                {
+                    last[d] = c;
+                    result.add_edge(c, d);
+                }
             }
         }
+    }
+    return result;
+}
 
-        return _result;
+class TarjanSCC
+{
+public:
+    // Strongly connected components (Tarjan), on the iterative DFS engine
+    //
+    // Components are numbered in the order they complete, which is a
+    // reverse topological order of the condensation.
+    //
+    // Time complexity: O(|V| + |E|)
+    typedef DGraph graph_t;
+
+    template <typename G = graph_t>
+    void search(const G& graph)
+    {
+        search(graph, Bitset(graph.V()));
+    }
+
+    // Only over the subgraph induced by the vertices not in @excluded,
+    // which get id -1.
+    template <typename G>
+    void search(const G& graph, Bitset excluded)
+    {
+        const int n = graph.V();
+        _ids = std::vector<int>(n, -1);
+        _count = 0;
+        _index = std::vector<int>(n, 0);
+        _low = std::vector<int>(n, 0);
+        _counter = 0;
+        _on_stack = Bitset(n);
+
+        DFSEngine<G> engine;
+        Visitor visitor{this};
+        engine.run_all(graph, excluded, visitor);
+
+        _index = std::vector<int>();
+        _low = std::vector<int>();
+    }
+
+    bool strongly_connected(int v, int w) const
+    {
+        return _ids[v] == _ids[w];
+    }
+
+    int id(int v) const { return _ids[v]; }
+    int num_scc() const { return _count; }
+    const std::vector<int>& ids() const { return _ids; }
+
+    template <typename G = graph_t>
+    DGraph condensation(const G& graph) const
+    {
+        return build_condensation(graph, _ids, _count);
     }
 
 private:
-    void dfs(const graph_t& graph, int v)
+    struct Visitor : DFSVisitor
     {
-        _marked[v] = true;
-        
-        for (int w : graph.adjacent(v))
+        TarjanSCC* self;
+
+        Visitor(TarjanSCC* self) : self(self) { }
+
+        void pre(int v)
+        {
+            self->_index[v] = self->_low[v] = self->_counter++;
+            self->_stack.push_back(v);
+            self->_on_stack.set(v);
+            self->_path.push_back(v);
+        }
+
+        bool non_tree_edge(int v, int w)
+        {
+            if (self->_on_stack.test(w))
+                self->_low[v] = std::min(self->_low[v], self->_index[w]);
+            return true;
+        }
+
+        void post(int v)
+        {
+            std::vector<int>& low = self->_low;
+            if (low[v] == self->_index[v])
+            {
+                int w;
+                do
+                {
+                    w = self->_stack.back();
+                    self->_stack.pop_back();
+                    self->_on_stack.reset(w);
+                    self->_ids[w] = self->_count;
+                } while (w != v);
+                ++self->_count;
+            }
+
+            self->_path.pop_back();
+            if (!self->_path.empty())
+            {
+                int p = self->_path.back();
+                low[p] = std::min(low[p], low[v]);
+            }
+        }
+    };
+
+    std::vector<int> _ids;
+    int _count;
+
+    std::vector<int> _index;    // preorder number
+    std::vector<int> _low;      // lowest index reachable through the stack
+    int _counter;
+    std::vector<int> _stack;    // vertices of unfinished components
+    Bitset _on_stack;
+    std::vector<int> _path;     // the DFS path, for the parents' low links
+};
+
+class ParallelSCC
+{
+public:
+    // Strongly connected components, multi-threaded
+    //
+    // 1. Trim: vertices with no in- or out-edges left are components of
+    //    their own; peeled level by level with atomic degree counters.
+    // 2. Coloring (Orzan): every vertex takes the largest vertex number
+    //    that reaches it, by parallel label propagation; the vertex that
+    //    owns a color and everything of that color reaching it backward form
+    //    a component. Repeated on what is left.
+    // 3. Once a round removes little (few large colors), its colors take
+    //    more than @_MAX_SWEEPS sweeps to settle (long paths against the
+    //    vertex order) or little is left, TarjanSCC finishes the rest.
+    //
+    // Components are numbered in order of their smallest vertex.
+    //
+    // Time complexity: O(|V| + |E|) per propagation sweep, at most
+    // @_MAX_SWEEPS sweeps per round
+    typedef DGraph graph_t;
+
+    ParallelSCC(int num_threads = 0)
+        : _num_threads(num_threads > 0 ? num_threads : default_num_threads())
+    { }
+
+    // @in_graph has the edges of @graph reversed, e.g. graph.reverse().
+    template <typename G = graph_t>
+    void search(const G& graph, const G& in_graph)
+    {
+        const int n = graph.V();
+        _done = AtomicBitset(n);
+        _rep = std::vector<int>(n, -1);
+
+        trim(graph, in_graph);
+
+        std::vector<int> alive = collect_alive(n);
+        while (alive.size() > _SEQUENTIAL)
+        {
+            if (!color(graph, alive))
+                break;
+            std::size_t before = alive.size();
+            claim_colors(in_graph, alive);
+            alive = collect_alive(n);
+            if (alive.size() > before - before / _MIN_PROGRESS)
+                break;
+        }
+
+        if (!alive.empty())
         {
-            if (!_marked[w])
-                dfs(graph, w);
+            Bitset excluded(n);
+            for (int v = 0; v < n; ++v)
+            {
+                if (_done.test(v))
+                    excluded.set(v);
+            }
+            TarjanSCC tarjan;
+            tarjan.search(graph, std::move(excluded));
+            // Those components are named after n + their id.
+            for (int v : alive)
+                _rep[v] = n + tarjan.id(v);
         }
-        _result.push(v);
+
+        number(n);
+        _done = AtomicBitset();
+        _rep = std::vector<int>();
+        _color = std::vector<std::atomic<int>>();
     }
 
-    std::vector<bool> _marked;
-    result_t _result;
+    bool strongly_connected(int v, int w) const
+    {
+        return _ids[v] == _ids[w];
+    }
+
+    int id(int v) const { return _ids[v]; }
+    int num_scc() const { return _count; }
+    const std::vector<int>& ids() const { return _ids; }
+
+    template <typename G = graph_t>
+    DGraph condensation(const G& graph) const
+    {
+        return build_condensation(graph, _ids, _count);
+    }
+
+private:
+    constexpr static std::size_t _GRAIN = 1024;
+    constexpr static std::size_t _SEQUENTIAL = 1 << 14;
+    constexpr static std::size_t _MIN_PROGRESS = 16;
+    constexpr static int _MAX_SWEEPS = 64;
+
+    // Runs fn(v, out) for every v in @frontier in parallel; the vertices
+    // passed to out.push_back() make up the new @frontier.
+    template <typename F>
+    void expand(std::vector<int>& frontier, F fn)
+    {
+        std::vector<std::vector<int>> locals(_num_threads);
+        parallel_chunks(_num_threads, frontier.size(), _GRAIN,
+                        [&](int t, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                fn(frontier[i], locals[t]);
+        });
+
+        frontier.clear();
+        for (const std::vector<int>& local : locals)
+            frontier.insert(frontier.end(), local.begin(), local.end());
+    }
+
+    std::vector<int> collect_alive(int n)
+    {
+        std::vector<std::vector<int>> locals(_num_threads);
+        parallel_chunks(_num_threads, n, _GRAIN * 16,
+                        [&](int t, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t v = begin; v < end; ++v)
+            {
+                if (!_done.test(v))
+                    locals[t].push_back(v);
+            }
+        });
+
+        std::vector<int> result;
+        for (const std::vector<int>& local : locals)
+            result.insert(result.end(), local.begin(), local.end());
+        return result;
+    }
+
+    template <typename G>
+    void trim(const G& graph, const G& in_graph)
+    {
+        const int n = graph.V();
+        std::vector<std::atomic<int>> in_degree(n);
+        std::vector<std::atomic<int>> out_degree(n);
+
+        // Self-loops do not keep a vertex alive.
+        auto degree = [](const auto& adj, int v)
+        {
+            int d = 0;
+            for (int w : adj)
+                d += w != v;
+            return d;
+        };
+
+        std::vector<int> frontier(n);
+        std::iota(frontier.begin(), frontier.end(), 0);
+        expand(frontier, [&](int v, std::vector<int>& out)
+        {
+            in_degree[v].store(degree(in_graph.adjacent(v), v),
+                               std::memory_order_relaxed);
+            out_degree[v].store(degree(graph.adjacent(v), v),
+                                std::memory_order_relaxed);
+            if (in_degree[v].load(std::memory_order_relaxed) == 0 ||
+                out_degree[v].load(std::memory_order_relaxed) == 0)
+            {
+                _done.set(v);
+                out.push_back(v);
+            }
+        });
+
+        while (!frontier.empty())
+        {
+            expand(frontier, [&](int v, std::vector<int>& out)
+            {
+                _rep[v] = v;
+                for (int w : graph.adjacent(v))
+                {
+                    if (w != v &&
+                        in_degree[w].fetch_sub(1, std::memory_order_relaxed) == 1 &&
+                        _done.set(w))
+                        out.push_back(w);
+                }
+                for (int u : in_graph.adjacent(v))
+                {
+                    if (u != v &&
+                        out_degree[u].fetch_sub(1, std::memory_order_relaxed) == 1 &&
+                        _done.set(u))
+                        out.push_back(u);
+                }
+            });
+        }
+    }
+
+    // Propagates the largest vertex number forward through @alive until no
+    // color changes. A color advances at least one edge per sweep, but on a
+    // path against the vertex order no more than that, so this gives up
+    // (returns false) after @_MAX_SWEEPS sweeps rather than going quadratic.
+    template <typename G>
+    bool color(const G& graph, const std::vector<int>& alive)
+    {
+        if (_color.size() != std::size_t(graph.V()))
+            _color = std::vector<std::atomic<int>>(graph.V());
+        for (int v : alive)
+            _color[v].store(v, std::memory_order_relaxed);
+
+        std::atomic<bool> changed(true);
+        for (int sweep = 0; changed.load(std::memory_order_relaxed); ++sweep)
+        {
+            if (sweep == _MAX_SWEEPS)
+                return false;
+            changed.store(false, std::memory_order_relaxed);
+            parallel_chunks(_num_threads, alive.size(), _GRAIN,
+                            [&](int, std::size_t begin, std::size_t end)
+            {
+                bool local = false;
+                for (std::size_t i = begin; i < end; ++i)
+                {
+                    int v = alive[i];
+                    int c = _color[v].load(std::memory_order_relaxed);
+                    for (int w : graph.adjacent(v))
+                    {
+                        if (_done.test(w)) continue;
+
+                        int old = _color[w].load(std::memory_order_relaxed);
+                        while (old < c &&
+                               !_color[w].compare_exchange_weak(
+                                   old, c, std::memory_order_relaxed))
+                        { }
+                        local |= old < c;
+                    }
+                }
+                if (local)
+                    changed.store(true, std::memory_order_relaxed);
+            });
+        }
+        return true;
+    }
+
+    // Each color's owner and the vertices of its color that reach it form a
+    // component; found by a backward BFS from all owners at once.
+    template <typename G>
+    void claim_colors(const G& in_graph, const std::vector<int>& alive)
+    {
+        std::vector<int> frontier(alive);
+        expand(frontier, [&](int v, std::vector<int>& out)
+        {
+            if (_color[v].load(std::memory_order_relaxed) == v)
+            {
+                _done.set(v);
+                out.push_back(v);
+            }
+        });
+
+        while (!frontier.empty())
+        {
+            expand(frontier, [&](int v, std::vector<int>& out)
+            {
+                int c = _color[v].load(std::memory_order_relaxed);
+                _rep[v] = c;
+                for (int u : in_graph.adjacent(v))
+                {
+                    if (!_done.test(u) &&
+                        _color[u].load(std::memory_order_relaxed) == c &&
+                        _done.set(u))
+                        out.push_back(u);
+                }
+            });
+        }
+    }
+
+    // Renames the components from their representatives (a vertex, or n +
+    // a TarjanSCC id) to 0, 1, ... in order of their smallest vertex.
+    void number(int n)
+    {
+        std::vector<int> name(2 * std::size_t(n), -1);
+        _ids = std::vector<int>(n);
+        _count = 0;
+        for (int v = 0; v < n; ++v)
+        {
+            int& c = name[_rep[v]];
+            if (c == -1)
+                c = _count++;
+            _ids[v] = c;
+        }
+    }
+
+    int _num_threads;
+    std::vector<int> _ids;
+    int _count;
+
+    AtomicBitset _done;                  // vertices with a component
+    std::vector<int> _rep;               // representative of the component
+    std::vector<std::atomic<int>> _color;
 };
 
 }; // namespace graph::directed
@@ -279,26 +1201,13 @@ public:
     // Time complexity: O(|V| + |E|)
     void traverse(const graph_t& graph) 
     {
-        _marked = std::vector<bool>(graph.V(), false);
-        for (int u = 0; u < graph.V(); ++u)
-        {
-            if (!_marked[u])
-                dfs(graph, u);
-        }
+        _marked = Bitset(graph.V());
+        DFSVisitor visitor;
+        DFSEngine<G>().run_all(graph, _marked, visitor);
     }
 
 private:
-    void dfs(const graph_t& graph, int v)
-    {
-        _marked[v] = true;
-        for (int w : graph.adjacent(v))
-        {
-            if (!_marked[w])
-                dfs(graph, w);
-        }
-    }
-
-    std::vector<bool> _marked;
+    Bitset _marked;
 };
 
 template <typename G>
@@ -314,14 +1223,15 @@ public:
     void search(const graph_t& graph, int src) 
     {
         _src = src;
-        _marked = std::vector<bool>(graph.V(), false);
+        _marked = Bitset(graph.V());
         _edge_to = std::vector<int>(graph.V(), -1);
         _count = 0;
 
-        dfs(graph, src);
+        Visitor visitor{this};
+        DFSEngine<G>().run(graph, src, _marked, visitor);
     }
 
-    inline bool reachable(int v) const { return _marked[v]; }
+    inline bool reachable(int v) const { return _marked.test(v); }
     inline int num_reachable(int v) const { return _count; }
 
     std::vector<int> path_to(int v) const
@@ -341,22 +1251,17 @@ public:
     }
 
 private:
-    void dfs(const graph_t& graph, int v)
+    struct Visitor : DFSVisitor
     {
-        _marked[v] = true;
-        ++_count;
-        for (int w : graph.adjacent(v))
-        {
-            if (!_marked[w])
-            {
-                _edge_to[w] = v;
-                dfs(graph, w);
-            }
-        }
-    }
+        DFSPaths* self;
+
+        Visitor(DFSPaths* self) : self(self) { }
+        void pre(int) { ++self->_count; }
+        void tree_edge(int v, int w) { self->_edge_to[w] = v; }
+    };
 
     int _src;
-    std::vector<bool> _marked;
+    Bitset _marked;
     std::vector<int> _edge_to;  // a tree rooted at @_src
     int _count;
 };
@@ -429,6 +1334,233 @@ private:
     int _count;
 };
 
+template <typename G>
+class ParallelBFSPaths
+{
+public:
+    typedef G graph_t;
+
+    // Single source problem, multi-threaded
+    //
+    // Level-synchronous BFS over frontier arrays with an atomic visited
+    // bitmap. Given the incoming edges too, it is direction-optimizing
+    // (Beamer et al.): once the frontier's edges outnumber those of the
+    // unvisited vertices / @_ALPHA, each unvisited vertex looks for a parent
+    // in a frontier bitmap instead (bottom-up), until the frontier shrinks
+    // below V / @_BETA again. Pays off on low-diameter graphs, whose middle
+    // levels hold most of the vertices.
+    //
+    // The tree may differ from BFSPaths', but its paths are shortest too.
+    //
+    // Time complexity: O(|V| + |E|) work, O(diameter) synchronizations
+    //
+    // Suitable for directed/undirected, unweighted graph
+
+    ParallelBFSPaths(int num_threads = 0)
+        : _num_threads(num_threads > 0 ? num_threads : default_num_threads())
+    { }
+
+    // Top-down only
+    void search(const graph_t& graph, int src) { search(graph, nullptr, src); }
+
+    // @in_graph has the edges of @graph reversed: graph.reverse() for a
+    // DGraph, @graph itself for an undirected one.
+    void search(const graph_t& graph, const graph_t& in_graph, int src)
+    {
+        search(graph, &in_graph, src);
+    }
+
+    inline bool reachable(int v) const { return _visited.test(v); }
+    inline int num_reachable(int) const { return _count; }
+
+    std::vector<int> path_to(int v) const
+    {
+        assert(reachable(v));
+        std::vector<int> result;
+
+        while (v != _src)
+        {
+            result.push_back(v);
+            v = _edge_to[v];
+        }
+        result.push_back(_src);
+
+        reverse(result.begin(), result.end());
+        return result;
+    }
+
+private:
+    constexpr static std::size_t _ALPHA = 14;
+    constexpr static std::size_t _BETA = 24;
+    constexpr static std::size_t _GRAIN = 1024;
+
+    void search(const graph_t& graph, const graph_t* in_graph, int src)
+    {
+        const int n = graph.V();
+        _src = src;
+        _visited = AtomicBitset(n);
+        _edge_to = std::vector<int>(n, -1);
+        _count = 0;
+
+        std::size_t unexplored = 0;  // edges out of unvisited vertices
+        for (int v = 0; v < n; ++v)
+            unexplored += graph.adjacent(v).size();
+
+        _frontier.assign(1, src);
+        _visited.set(src);
+        std::size_t num_frontier = 1;
+        std::size_t scout = graph.adjacent(src).size();
+        bool bottom_up = false;
+
+        while (num_frontier > 0)
+        {
+            _count += num_frontier;
+            unexplored -= scout;
+
+            if (!bottom_up && in_graph && scout > unexplored / _ALPHA)
+            {
+                _frontier_bits = Bitset(n);
+                for (int v : _frontier)
+                    _frontier_bits.set(v);
+                _next_bits = Bitset(n);
+                bottom_up = true;
+            }
+            else if (bottom_up && num_frontier < n / _BETA)
+            {
+                bits_to_list(_frontier_bits, _frontier);
+                bottom_up = false;
+            }
+
+            std::size_t next = 0;
+            if (bottom_up)
+            {
+                next = bottom_up_step(graph, *in_graph, scout);
+                std::swap(_frontier_bits, _next_bits);
+            }
+            else
+            {
+                next = top_down_step(graph, scout);
+            }
+            num_frontier = next;
+        }
+    }
+
+    // Expands _frontier into itself; returns its new size and sets @scout to
+    // the number of edges out of it.
+    std::size_t top_down_step(const graph_t& graph, std::size_t& scout)
+    {
+        _locals.resize(_num_threads);
+        std::vector<std::size_t> scouts(_num_threads, 0);
+        parallel_chunks(_num_threads, _frontier.size(), _GRAIN,
+                        [&](int t, std::size_t begin, std::size_t end)
+        {
+            std::vector<int>& local = _locals[t];
+            std::size_t local_scout = 0;
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                int v = _frontier[i];
+                for (int w : graph.adjacent(v))
+                {
+                    if (_visited.set(w))
+                    {
+                        _edge_to[w] = v;
+                        local.push_back(w);
+                        local_scout += graph.adjacent(w).size();
+                    }
+                }
+            }
+            scouts[t] = local_scout;
+        });
+
+        _frontier.clear();
+        scout = 0;
+        for (int t = 0; t < _num_threads; ++t)
+        {
+            _frontier.insert(_frontier.end(), _locals[t].begin(),
+                             _locals[t].end());
+            _locals[t].clear();
+            scout += scouts[t];
+        }
+        return _frontier.size();
+    }
+
+    // Every unvisited vertex with a parent in _frontier_bits joins
+    // _next_bits; returns their number and sets @scout to the number of
+    // edges out of them.
+    std::size_t bottom_up_step(const graph_t& graph, const graph_t& in_graph,
+                               std::size_t& scout)
+    {
+        const int n = graph.V();
+        std::vector<std::size_t> counts(_num_threads, 0);
+        std::vector<std::size_t> scouts(_num_threads, 0);
+        _next_bits.clear();
+        parallel_chunks(_num_threads, n, _GRAIN,
+                        [&](int t, std::size_t begin, std::size_t end)
+        {
+            // The chunk owns its words of _visited and _next_bits.
+            std::size_t count = 0;
+            std::size_t local_scout = 0;
+            for (std::size_t k = begin / 64; k * 64 < end; ++k)
+            {
+                for (std::uint64_t todo = ~_visited.word(k); todo != 0;
+                     todo &= todo - 1)
+                {
+                    int v = k * 64 + __builtin_ctzll(todo);
+                    if (v >= n) break;
+
+                    for (int u : in_graph.adjacent(v))
+                    {
+                        if (_frontier_bits.test(u))
+                        {
+                            _edge_to[v] = u;
+                            _visited.set(v);
+                            _next_bits.set(v);
+                            ++count;
+                            local_scout += graph.adjacent(v).size();
+                            break;
+                        }
+                    }
+                }
+            }
+            counts[t] = count;
+            scouts[t] = local_scout;
+        });
+
+        scout = 0;
+        std::size_t count = 0;
+        for (int t = 0; t < _num_threads; ++t)
+        {
+            count += counts[t];
+            scout += scouts[t];
+        }
+        return count;
+    }
+
+    void bits_to_list(const Bitset& bits, std::vector<int>& list)
+    {
+        list.clear();
+        for (std::size_t k = 0; k * 64 < std::size_t(bits.size()); ++k)
+        {
+            for (std::uint64_t word = bits.word(k); word != 0;
+                 word &= word - 1)
+            {
+                list.push_back(k * 64 + __builtin_ctzll(word));
+            }
+        }
+    }
+
+    int _num_threads;
+    int _src;
+    AtomicBitset _visited;
+    std::vector<int> _edge_to;  // a tree rooted at @_src
+    int _count;
+
+    std::vector<int> _frontier;
+    std::vector<std::vector<int>> _locals;  // next frontier, per thread
+    Bitset _frontier_bits;
+    Bitset _next_bits;
+};
+
 }; // namespace graph
 
 #endif
\ No newline at end of file
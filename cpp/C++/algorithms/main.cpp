@@ -0,0 +1,457 @@
+// Checks the graph algorithms on generated graphs: the iterative DFS against
+// the recursive one it replaced (and on paths too deep for recursion),
+// CSRGraph against the adjacency-list graphs, and the parallel algorithms
+// against their sequential counterparts.
+//
+//   g++ -std=c++17 -O2 -pthread main.cpp && ./a.out
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "graph.hpp"
+
+using namespace graph;
+
+// @V vertices with @E random edges (self-loops and duplicates included).
+template <typename G>
+G random_graph(int V, int E, std::mt19937& rng)
+{
+    G graph(V);
+    std::uniform_int_distribution<int> vertex(0, V - 1);
+    for (int i = 0; i < E; ++i)
+        graph.add_edge(vertex(rng), vertex(rng));
+    return graph;
+}
+
+// Cycles of @len vertices, each linked to the next by one edge: long
+// chains for the SCC trimming and coloring rounds.
+directed::DGraph cycle_chain(int num_cycles, int len)
+{
+    directed::DGraph graph(num_cycles * len);
+    for (int c = 0; c < num_cycles; ++c)
+    {
+        for (int i = 0; i < len; ++i)
+            graph.add_edge(c * len + i, c * len + (i + 1) % len);
+        if (c + 1 < num_cycles)
+            graph.add_edge(c * len, (c + 1) * len);
+    }
+    return graph;
+}
+
+// One cycle against the vertex order: i -> i - 1, and 0 -> V - 1. A color
+// crosses a single edge per propagation sweep here, so ParallelSCC has to
+// give up on coloring rather than take V sweeps.
+directed::DGraph descending_cycle(int V)
+{
+    directed::DGraph graph(V);
+    for (int i = 1; i < V; ++i)
+        graph.add_edge(i, i - 1);
+    graph.add_edge(0, V - 1);
+    return graph;
+}
+
+bool has_edge(const CSRGraph& graph, int v, int w)
+{
+    for (int x : graph.adjacent(v))
+    {
+        if (x == w)
+            return true;
+    }
+    return false;
+}
+
+// Same vertices reached; every parallel path follows edges and is as short
+// as the sequential one.
+template <typename G>
+void check_bfs(const G& graph, const G& in_graph, int src, int num_threads)
+{
+    CSRGraph csr(graph);
+    CSRGraph in_csr(in_graph);
+    BFSPaths<CSRGraph> expected;
+    expected.search(csr, src);
+
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        ParallelBFSPaths<CSRGraph> actual(num_threads);
+        if (pass == 0)
+            actual.search(csr, src);
+        else
+            actual.search(csr, in_csr, src);
+
+        assert(actual.num_reachable(src) == expected.num_reachable(src));
+        for (int v = 0; v < graph.V(); ++v)
+        {
+            assert(actual.reachable(v) == expected.reachable(v));
+            if (!actual.reachable(v))
+                continue;
+            std::vector<int> path = actual.path_to(v);
+            assert(path.size() == expected.path_to(v).size());
+            assert(path.front() == src && path.back() == v);
+            for (std::size_t i = 1; i < path.size(); ++i)
+                assert(has_edge(csr, path[i - 1], path[i]));
+        }
+    }
+}
+
+template <typename G>
+bool same_adjacency(const G& graph, const CSRGraph& csr)
+{
+    if (csr.V() != graph.V() || csr.E() != graph.E())
+        return false;
+    for (int v = 0; v < graph.V(); ++v)
+    {
+        const auto& adj = graph.adjacent(v);
+        CSRGraph::adj_iter_t csr_adj = csr.adjacent(v);
+        if (!std::equal(adj.begin(), adj.end(), csr_adj.begin(), csr_adj.end()))
+            return false;
+    }
+    return true;
+}
+
+// Same tree, vertex by vertex: the searches see the neighbors in the same
+// order.
+template <typename Paths, typename CSRPaths>
+void check_same_paths(const Paths& expected, const CSRPaths& actual, int V)
+{
+    for (int v = 0; v < V; ++v)
+    {
+        assert(actual.reachable(v) == expected.reachable(v));
+        if (actual.reachable(v))
+            assert(actual.path_to(v) == expected.path_to(v));
+    }
+}
+
+// Both CSRGraph constructions keep every neighbor list in order, so each
+// algorithm gives the same result on them as on UGraph/DGraph.
+void check_csr(std::mt19937& rng, bool acyclic)
+{
+    const int V = 2000;
+    std::uniform_int_distribution<int> vertex(0, V - 1);
+    std::vector<CSRGraph::edge_t> edges;
+    if (acyclic)
+    {
+        // A forest, which also makes the directed graph a DAG.
+        for (int v = 1; v < V; v += 2)
+            edges.emplace_back(std::uniform_int_distribution<int>(0, v - 1)(rng), v);
+    }
+    else
+    {
+        for (int i = 0; i < 3 * V; ++i)
+            edges.emplace_back(vertex(rng), vertex(rng));
+    }
+
+    undirected::UGraph ugraph(V);
+    directed::DGraph dgraph(V);
+    for (const CSRGraph::edge_t& e : edges)
+    {
+        ugraph.add_edge(e.first, e.second);
+        dgraph.add_edge(e.first, e.second);
+    }
+
+    CSRGraph ucsr = CSRGraph::from_edges(V, edges, false);
+    CSRGraph dcsr = CSRGraph::from_edges(V, edges, true);
+    assert(same_adjacency(ugraph, ucsr));
+    assert(same_adjacency(ugraph, CSRGraph(ugraph)));
+    assert(same_adjacency(dgraph, dcsr));
+    assert(same_adjacency(dgraph, CSRGraph(dgraph)));
+
+    DFSPaths<undirected::UGraph> udfs;
+    DFSPaths<CSRGraph> ucsr_dfs;
+    udfs.search(ugraph, 0);
+    ucsr_dfs.search(ucsr, 0);
+    check_same_paths(udfs, ucsr_dfs, V);
+
+    BFSPaths<directed::DGraph> dbfs;
+    BFSPaths<CSRGraph> dcsr_bfs;
+    dbfs.search(dgraph, 0);
+    dcsr_bfs.search(dcsr, 0);
+    check_same_paths(dbfs, dcsr_bfs, V);
+
+    undirected::ConnectedComponents cc;
+    undirected::ConnectedComponents csr_cc;
+    cc.search(ugraph);
+    csr_cc.search(ucsr);
+    assert(csr_cc.num_cc() == cc.num_cc());
+    for (int v = 0; v < V; ++v)
+        assert(csr_cc.id(v) == cc.id(v));
+
+    undirected::UCycle ucycle;
+    undirected::UCycle csr_ucycle;
+    ucycle.search(ugraph);
+    csr_ucycle.search(ucsr);
+    assert(ucycle.has_cycle() == !acyclic);
+    assert(csr_ucycle.has_cycle() == ucycle.has_cycle());
+
+    directed::DCycle dcycle;
+    directed::DCycle csr_dcycle;
+    dcycle.search(dgraph);
+    csr_dcycle.search(dcsr);
+    assert(dcycle.has_cycle() == !acyclic);
+    assert(csr_dcycle.has_cycle() == dcycle.has_cycle());
+}
+
+// The recursive search the DFS-based algorithms were ported from, as the
+// reference for their results on small graphs.
+template <typename G>
+void recursive_dfs(const G& graph, int v, std::vector<bool>& marked,
+                   std::vector<int>& edge_to, std::vector<int>& postorder)
+{
+    marked[v] = true;
+    for (int w : graph.adjacent(v))
+    {
+        if (!marked[w])
+        {
+            edge_to[w] = v;
+            recursive_dfs(graph, w, marked, edge_to, postorder);
+        }
+    }
+    postorder.push_back(v);
+}
+
+// DFSPaths and TopologicalSort give what the recursive versions did: the
+// same tree, and the reverse postorder over all vertices.
+void check_dfs_order(std::mt19937& rng)
+{
+    const int V = 500;
+    std::uniform_int_distribution<int> vertex(0, V - 1);
+    directed::DGraph graph(V);
+    directed::DGraph dag(V);
+    for (int i = 0; i < 3 * V; ++i)
+    {
+        int v = vertex(rng), w = vertex(rng);
+        graph.add_edge(v, w);
+        if (v != w)
+            dag.add_edge(std::min(v, w), std::max(v, w));
+    }
+
+    std::vector<bool> marked(V, false);
+    std::vector<int> edge_to(V, -1);
+    std::vector<int> postorder;
+    recursive_dfs(graph, 0, marked, edge_to, postorder);
+    DFSPaths<directed::DGraph> paths;
+    paths.search(graph, 0);
+    for (int v = 0; v < V; ++v)
+    {
+        assert(paths.reachable(v) == marked[v]);
+        if (!marked[v])
+            continue;
+        std::vector<int> expected;
+        for (int w = v; w != -1; w = edge_to[w])
+            expected.insert(expected.begin(), w);
+        assert(paths.path_to(v) == expected);
+    }
+
+    marked.assign(V, false);
+    postorder.clear();
+    for (int v = 0; v < V; ++v)
+    {
+        if (!marked[v])
+            recursive_dfs(dag, v, marked, edge_to, postorder);
+    }
+    directed::TopologicalSort::result_t order =
+        directed::TopologicalSort().sort(dag);
+    std::vector<int> position(V);
+    for (int i = 0; !order.empty(); ++i, order.pop())
+    {
+        assert(order.top() == postorder[V - 1 - i]);
+        position[order.top()] = i;
+    }
+    for (int v = 0; v < V; ++v)
+    {
+        for (int w : dag.adjacent(v))
+            assert(position[v] < position[w]);
+    }
+}
+
+void check_cycles()
+{
+    directed::DGraph triangle(3);
+    triangle.add_edge(0, 1);
+    triangle.add_edge(1, 2);
+    triangle.add_edge(2, 0);
+    directed::DCycle dcycle;
+    dcycle.search(triangle);
+    assert(dcycle.has_cycle());
+    assert(directed::TopologicalSort().sort(triangle).empty());
+
+    // A diamond: two paths to 3, but no cycle.
+    directed::DGraph diamond(4);
+    diamond.add_edge(0, 1);
+    diamond.add_edge(0, 2);
+    diamond.add_edge(1, 3);
+    diamond.add_edge(2, 3);
+    dcycle.search(diamond);
+    assert(!dcycle.has_cycle());
+    assert(directed::TopologicalSort().sort(diamond).size() == 4);
+
+    directed::DGraph self_loop(2);
+    self_loop.add_edge(0, 1);
+    self_loop.add_edge(1, 1);
+    dcycle.search(self_loop);
+    assert(dcycle.has_cycle());
+
+    // Undirected, the diamond is a cycle; a star is not.
+    undirected::UGraph square(4);
+    square.add_edge(0, 1);
+    square.add_edge(0, 2);
+    square.add_edge(1, 3);
+    square.add_edge(2, 3);
+    undirected::UCycle ucycle;
+    ucycle.search(square);
+    assert(ucycle.has_cycle());
+
+    undirected::UGraph star(4);
+    for (int v = 1; v < 4; ++v)
+        star.add_edge(0, v);
+    ucycle.search(star);
+    assert(!ucycle.has_cycle());
+}
+
+// A path far deeper than a recursive search could go on a default 8 MB
+// thread stack.
+void check_deep_path()
+{
+    const int V = 3000000;
+    std::vector<CSRGraph::edge_t> edges;
+    edges.reserve(V);
+    for (int v = 0; v + 1 < V; ++v)
+        edges.emplace_back(v, v + 1);
+    CSRGraph path = CSRGraph::from_edges(V, edges, true);
+    CSRGraph upath = CSRGraph::from_edges(V, edges, false);
+
+    directed::DCycle dcycle;
+    dcycle.search(path);
+    assert(!dcycle.has_cycle());
+
+    directed::TopologicalSort::result_t order =
+        directed::TopologicalSort().sort(path);
+    for (int v = 0; v < V; ++v, order.pop())
+        assert(order.top() == v);
+
+    directed::TarjanSCC scc;
+    scc.search(path);
+    assert(scc.num_scc() == V);
+
+    DFSPaths<CSRGraph> paths;
+    paths.search(upath, 0);
+    assert(int(paths.path_to(V - 1).size()) == V);
+
+    undirected::ConnectedComponents cc;
+    cc.search(upath);
+    assert(cc.num_cc() == 1);
+
+    undirected::UCycle ucycle;
+    ucycle.search(upath);
+    assert(!ucycle.has_cycle());
+
+    // Closing the path makes it one cycle, found at the bottom of the search.
+    edges.emplace_back(V - 1, 0);
+    CSRGraph ring = CSRGraph::from_edges(V, edges, true);
+    dcycle.search(ring);
+    assert(dcycle.has_cycle());
+    scc.search(ring);
+    assert(scc.num_scc() == 1);
+    ucycle.search(CSRGraph::from_edges(V, edges, false));
+    assert(ucycle.has_cycle());
+}
+
+void check_cc(const undirected::UGraph& graph, int num_threads)
+{
+    undirected::ConnectedComponents expected;
+    expected.search(graph);
+    undirected::ParallelConnectedComponents actual(num_threads);
+    actual.search(graph);
+
+    // Both number components by their smallest vertex.
+    assert(actual.num_cc() == expected.num_cc());
+    for (int v = 0; v < graph.V(); ++v)
+        assert(actual.id(v) == expected.id(v));
+}
+
+void check_scc(const directed::DGraph& graph, int num_threads)
+{
+    directed::TarjanSCC expected;
+    expected.search(graph);
+    directed::ParallelSCC actual(num_threads);
+    actual.search(graph, graph.reverse());
+
+    // The numberings differ; the partitions must not.
+    assert(actual.num_scc() == expected.num_scc());
+    std::vector<int> to_actual(expected.num_scc(), -1);
+    std::vector<int> to_expected(actual.num_scc(), -1);
+    for (int v = 0; v < graph.V(); ++v)
+    {
+        int e = expected.id(v);
+        int a = actual.id(v);
+        assert(a >= 0 && a < actual.num_scc());
+        if (to_actual[e] == -1)
+        {
+            assert(to_expected[a] == -1);
+            to_actual[e] = a;
+            to_expected[a] = e;
+        }
+        assert(to_actual[e] == a && to_expected[a] == e);
+    }
+
+    directed::DGraph condensation = actual.condensation(graph);
+    assert(condensation.V() == actual.num_scc());
+    assert(condensation.E() == expected.condensation(graph).E());
+}
+
+void check_parallel_chunks_rethrows()
+{
+    std::vector<int> done(4, 0);
+    bool caught = false;
+    try
+    {
+        parallel_chunks(4, 4 * 1024, 1, [&](int t, std::size_t, std::size_t)
+        {
+            done[t] = 1;
+            if (t == 2)
+                throw std::runtime_error("chunk 2");
+        });
+    }
+    catch (const std::runtime_error& e)
+    {
+        caught = std::string(e.what()) == "chunk 2";
+    }
+    assert(caught);
+    assert(done == std::vector<int>(4, 1));
+}
+
+int main()
+{
+    std::mt19937 rng(42);
+
+    check_csr(rng, false);
+    check_csr(rng, true);
+    check_dfs_order(rng);
+    check_cycles();
+    check_deep_path();
+
+    for (int num_threads : {1, 4})
+    {
+        // Sparse and dense, so that the direction-optimizing BFS goes
+        // bottom-up on the latter.
+        for (int degree : {1, 2, 16})
+        {
+            const int V = 20000;
+            auto ugraph = random_graph<undirected::UGraph>(V, V * degree / 2, rng);
+            check_bfs(ugraph, ugraph, 0, num_threads);
+            check_cc(ugraph, num_threads);
+
+            auto dgraph = random_graph<directed::DGraph>(V, V * degree, rng);
+            check_bfs(dgraph, dgraph.reverse(), 0, num_threads);
+            check_scc(dgraph, num_threads);
+        }
+        check_scc(cycle_chain(500, 40), num_threads);
+        check_scc(descending_cycle(200000), num_threads);
+        check_scc(directed::DGraph(100), num_threads);
+    }
+
+    check_parallel_chunks_rethrows();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+
+#include "stl.h"
+
+namespace taichi {
+
+// Arena-backed decoding: load into std::pmr containers created by a
+// DecodeArena and every string, vector and map node they decode allocates
+// from one monotonic region instead of the heap. Allocator-aware elements
+// (std::pmr::vector<std::pmr::string>, std::pmr::map of pmr strings, ...)
+// pick up the same arena through uses-allocator construction.
+//
+// The first block is sized from the archive, which for byte-heavy payloads
+// is close to the decoded size; the region grows geometrically past that.
+// Nothing is freed until the arena goes away, so it must outlive everything
+// decoded into it.
+class DecodeArena {
+ public:
+  explicit DecodeArena(std::size_t archive_size)
+      : resource_(std::max(archive_size, kMinBlockSize)) {}
+
+  DecodeArena(const DecodeArena&) = delete;
+  DecodeArena& operator=(const DecodeArena&) = delete;
+
+  std::pmr::memory_resource* resource() { return &resource_; }
+
+  // An empty T that allocates from the arena if it is allocator-aware.
+  template <typename T>
+  T make() {
+    return detail::make_with_allocator<T>(
+        std::pmr::polymorphic_allocator<std::byte>(&resource_));
+  }
+
+ private:
+  static constexpr std::size_t kMinBlockSize = 4096;
+
+  std::pmr::monotonic_buffer_resource resource_;
+};
+
+}  // namespace taichi
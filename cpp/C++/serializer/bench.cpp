@@ -0,0 +1,396 @@
+// Save-path benchmark for the serializers in this directory and for
+// template/'s BinarySerializer. Prints one JSON object per line:
+//
+//   serializer_bench [min_seconds] [filter]
+//
+// Each case is repeated for at least |min_seconds| (default 0.5); |filter|
+// keeps only the cases whose "serializer/payload" name contains it.
+// Throughput (mb_per_s) is measured against "payload_bytes", the size of the
+// payload's plain binary archive, so that it compares across serializers;
+// "archive_bytes" is what each one actually produced.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <new>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "binary.h"
+#include "binary_serializer.h"
+#include "checksum.h"
+#include "compress.h"
+#include "gather.h"
+#include "stl.h"
+#include "text.h"
+
+namespace {
+
+// Counts every allocation made through the global operator new. All the
+// replaceable forms are replaced so that none of them pairs the library's
+// allocation with our free() or the other way round.
+std::size_t num_allocs = 0;
+std::size_t num_alloc_bytes = 0;
+
+}  // namespace
+
+void *operator new(std::size_t size) {
+  ++num_allocs;
+  num_alloc_bytes += size;
+  if (void *p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t align) {
+  ++num_allocs;
+  num_alloc_bytes += size;
+  // aligned_alloc wants a multiple of the alignment.
+  const auto a = static_cast<std::size_t>(align);
+  const auto rounded = (std::max<std::size_t>(size, 1) + a - 1) / a * a;
+  if (void *p = std::aligned_alloc(a, rounded)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new(std::size_t size, std::align_val_t align,
+                   const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size, align);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+void *operator new[](std::size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return operator new(size, std::nothrow);
+}
+void *operator new[](std::size_t size, std::align_val_t align,
+                     const std::nothrow_t &) noexcept {
+  return operator new(size, align, std::nothrow);
+}
+
+// Kept out of line: once inlined, GCC sees free() on the result of operator
+// new in library code and warns (-Wmismatched-new-delete).
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+void operator delete(void *p, std::align_val_t) noexcept { operator delete(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  operator delete(p);
+}
+void operator delete(void *p, std::align_val_t,
+                     const std::nothrow_t &) noexcept {
+  operator delete(p);
+}
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  operator delete(p);
+}
+void operator delete[](void *p, std::align_val_t,
+                       const std::nothrow_t &) noexcept {
+  operator delete(p);
+}
+
+namespace {
+
+// The taichi serializers take io() fields as ser(a, b, c), template/'s
+// BinarySerializer as ser.HHH(names, a, b, c).
+template <typename S, typename... Args>
+void io_fields(S &ser, const Args &... args) {
+  if constexpr (std::is_same_v<S, BinarySerializer>) {
+    ser.HHH(nullptr, args...);
+  } else {
+    ser(args...);
+  }
+}
+
+struct Foo {
+  int a{0};
+  float b{42.0f};
+  std::string c{"abc"};
+
+  template <typename S>
+  void io(S &ser) const {
+    io_fields(ser, a, b, c);
+  }
+};
+
+struct Parent {
+  struct Child {
+    int a{0};
+    float b{0.0f};
+    bool c{false};
+
+    template <typename S>
+    void io(S &ser) const {
+      io_fields(ser, a, b, c);
+    }
+  };
+
+  std::optional<Child> b;
+  std::string c;
+
+  template <typename S>
+  void io(S &ser) const {
+    io_fields(ser, b, c);
+  }
+};
+
+// Every field has a fixed size: the common record shape.
+struct Record {
+  std::int64_t id{0};
+  float x{0.0f};
+  float y{0.0f};
+  float z{0.0f};
+  std::uint8_t kind{0};
+
+  template <typename S>
+  void io(S &ser) const {
+    io_fields(ser, id, x, y, z, kind);
+  }
+
+  // What TI_IO_DEF declares for template/'s fixed-layout path.
+  auto ti_io_fields() const { return std::tie(id, x, y, z, kind); }
+};
+
+constexpr std::size_t kNumElements = 1 << 16;
+
+std::string make_string(std::size_t i) {
+  return std::string(i % 48, static_cast<char>('a' + i % 26));
+}
+
+struct Payloads {
+  std::vector<float> pod_vector;
+  std::vector<Foo> io_structs;
+  std::vector<Record> records;
+  std::vector<Parent> optionals;
+  std::vector<std::string> strings;
+  std::map<int, std::string> map;
+  std::unordered_map<std::string, double> unordered_map;
+  std::map<std::int64_t, double> pod_map;
+
+  Payloads() {
+    pod_vector.resize(kNumElements * 16);
+    for (std::size_t i = 0; i < pod_vector.size(); ++i) {
+      pod_vector[i] = static_cast<float>(i) * 0.5f;
+    }
+    for (std::size_t i = 0; i < kNumElements; ++i) {
+      const int n = static_cast<int>(i);
+      io_structs.push_back({n, n * 0.25f, make_string(i)});
+      records.push_back({n, n * 0.5f, n * 0.25f, n * 0.125f,
+                         static_cast<std::uint8_t>(i % 7)});
+      Parent p;
+      if (i % 2 == 0) {
+        p.b = Parent::Child{n, n * 0.5f, i % 4 == 0};
+      }
+      p.c = make_string(i / 2);
+      optionals.push_back(std::move(p));
+      strings.push_back(make_string(i));
+      map.emplace(n, make_string(i));
+      unordered_map.emplace(std::to_string(i), n * 0.125);
+      pod_map.emplace(n, n * 0.125);
+    }
+  }
+};
+
+// Keeps the compiler from dropping writes to an archive nobody reads.
+void escape(const void *p) {
+#if defined(__GNUC__)
+  asm volatile("" : : "g"(p) : "memory");
+#endif
+}
+
+// Each of these serializes |payload| once and returns the archive size.
+template <typename T>
+std::size_t save_text(const T &payload) {
+  taichi::TextOutputSerializer ser;
+  ser(payload);
+  escape(ser.get_result().data());
+  return ser.get_result().size();
+}
+
+template <typename Format = taichi::NativeFormat, typename T>
+std::size_t save_binary(const T &payload) {
+  taichi::BasicBinaryOutputSerializer<taichi::VectorSink, Format> ser;
+  ser(payload);
+  escape(ser.get_result().data());
+  return ser.get_result().size();
+}
+
+template <typename T>
+std::size_t save_two_phase(const T &payload) {
+  const auto archive = taichi::serialize(payload);
+  escape(archive.data());
+  return archive.size();
+}
+
+// Includes writing the archive out, since that is where the referenced
+// payloads finally get copied: into a scratch file, rewritten in place each
+// time (/dev/null would not touch the bytes at all).
+template <typename T>
+std::size_t save_gather(const T &payload) {
+  static const int fd = ::fileno(std::tmpfile());
+  taichi::GatherBinaryOutputSerializer ser;
+  ser(payload);
+  const auto &archive = ser.get_result();
+  ::lseek(fd, 0, SEEK_SET);
+  archive.write_to(fd);
+  return archive.size();
+}
+
+template <typename T>
+std::size_t save_checksummed(const T &payload) {
+  taichi::ChecksummedBinaryOutputSerializer ser;
+  ser(payload);
+  const auto &archive = ser.get_result();
+  escape(archive.data());
+  return archive.size();
+}
+
+template <typename Codec, typename T>
+std::size_t save_compressed(const T &payload) {
+  taichi::BasicBinaryOutputSerializer<
+      taichi::CompressingSink<taichi::VectorSink, Codec>>
+      ser;
+  ser(payload);
+  const auto &archive = ser.get_result();
+  escape(archive.data());
+  return archive.size();
+}
+
+template <typename T>
+std::size_t save_template(const T &payload) {
+  BinarySerializer ser;
+  ser.HHH(payload);
+  escape(ser.data.data());
+  return ser.head;
+}
+
+struct Result {
+  std::size_t iterations{0};
+  std::size_t bytes{0};
+  double seconds{0};
+  std::size_t allocs{0};
+  std::size_t alloc_bytes{0};
+};
+
+Result run(const std::function<std::size_t()> &fn, double min_seconds) {
+  using Clock = std::chrono::steady_clock;
+  fn();  // Warm up.
+  Result r;
+  const auto allocs_before = num_allocs;
+  const auto alloc_bytes_before = num_alloc_bytes;
+  const auto start = Clock::now();
+  do {
+    r.bytes += fn();
+    ++r.iterations;
+    r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  } while (r.seconds < min_seconds);
+  r.allocs = num_allocs - allocs_before;
+  r.alloc_bytes = num_alloc_bytes - alloc_bytes_before;
+  return r;
+}
+
+void report(const char *serializer, const char *payload,
+            std::size_t num_objects, std::size_t payload_bytes,
+            const Result &r) {
+  const double iters = static_cast<double>(r.iterations);
+  std::printf(
+      "{\"serializer\":\"%s\",\"payload\":\"%s\",\"objects\":%zu,"
+      "\"payload_bytes\":%zu,\"archive_bytes\":%zu,\"iterations\":%zu,"
+      "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"objects_per_s\":%.0f,"
+      "\"allocs_per_iter\":%.1f,\"alloc_bytes_per_iter\":%.0f}\n",
+      serializer, payload, num_objects, payload_bytes,
+      r.bytes / r.iterations, r.iterations, r.seconds,
+      payload_bytes * iters / r.seconds / 1e6,
+      num_objects * iters / r.seconds, r.allocs / iters,
+      r.alloc_bytes / iters);
+  std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  const double min_seconds = argc > 1 ? std::atof(argv[1]) : 0.5;
+  const std::string filter = argc > 2 ? argv[2] : "";
+  const Payloads payloads;
+
+  std::size_t payload_bytes = 0;
+  auto bench = [&](const char *serializer, const char *payload,
+                   std::size_t num_objects, std::function<std::size_t()> fn) {
+    const std::string name = std::string(serializer) + "/" + payload;
+    if (name.find(filter) == std::string::npos) {
+      return;
+    }
+    report(serializer, payload, num_objects, payload_bytes,
+           run(fn, min_seconds));
+  };
+
+  auto bench_all = [&](const char *payload, const auto &value,
+                       std::size_t num_objects) {
+    payload_bytes = save_binary(value);
+    bench("text", payload, num_objects, [&] { return save_text(value); });
+    bench("binary", payload, num_objects, [&] { return save_binary(value); });
+    bench("binary_big_endian", payload, num_objects,
+          [&] { return save_binary<taichi::BigEndianFormat>(value); });
+    bench("binary_two_phase", payload, num_objects,
+          [&] { return save_two_phase(value); });
+    bench("binary_gather", payload, num_objects,
+          [&] { return save_gather(value); });
+    bench("binary_crc32c", payload, num_objects,
+          [&] { return save_checksummed(value); });
+    bench("binary_lz", payload, num_objects,
+          [&] { return save_compressed<taichi::LzCodec>(value); });
+#ifdef TI_SERIALIZER_WITH_ZSTD
+    bench("binary_zstd", payload, num_objects,
+          [&] { return save_compressed<taichi::ZstdCodec>(value); });
+#endif
+    bench("template_binary", payload, num_objects,
+          [&] { return save_template(value); });
+  };
+
+  bench_all("pod_vector", payloads.pod_vector, payloads.pod_vector.size());
+  bench_all("io_structs", payloads.io_structs, payloads.io_structs.size());
+  bench_all("records", payloads.records, payloads.records.size());
+  bench_all("optionals", payloads.optionals, payloads.optionals.size());
+  bench_all("strings", payloads.strings, payloads.strings.size());
+  bench_all("map", payloads.map, payloads.map.size());
+  bench_all("unordered_map", payloads.unordered_map,
+            payloads.unordered_map.size());
+  bench_all("pod_map", payloads.pod_map, payloads.pod_map.size());
+  return 0;
+}
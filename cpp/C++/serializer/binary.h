@@ -1,64 +1,1165 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#include <memory>
 
+#include "byte_order.h"
 #include "serializer.h"
+#include "stl.h"
 
 namespace taichi {
 
-class BinaryOutputSerializer : public OutputSerializer<BinaryOutputSerializer> {
+// Non-owning (pointer, length) window onto a contiguous run of T. Loading one
+// from a BinaryInputSerializer points it straight into the archive buffer, so
+// it is only valid while that buffer is alive.
+template <typename T>
+class ArrayView {
+ public:
+  ArrayView() = default;
+  ArrayView(const T* data, std::size_t size) : data_(data), size_(size) {}
+  explicit ArrayView(const std::vector<T>& vec)
+      : data_(vec.data()), size_(vec.size()) {}
+
+  const T* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  const T& operator[](std::size_t i) const { return data_[i]; }
+
+ private:
+  const T* data_{nullptr};
+  std::size_t size_{0};
+};
+
+// Wire formats, selected by the serializers' second template parameter.
+// NativeFormat stores every value at its in-memory width and byte order.
+struct NativeFormat {
+  static constexpr bool kVarintIntegers = false;
+  static constexpr ByteOrder kByteOrder = kHostByteOrder;
+};
+
+// Stores integers wider than a byte, container sizes included, as LEB128
+// varints, with signed ones zigzag-encoded first. Archives of small counts
+// and IDs shrink several-fold; integer ranges lose their bulk/zero-copy path.
+struct CompactFormat {
+  static constexpr bool kVarintIntegers = true;
+  static constexpr ByteOrder kByteOrder = kHostByteOrder;
+};
+
+// Fixed byte order, so that archives can be read on hosts of either
+// endianness. When the host order matches, these encode exactly like
+// NativeFormat; otherwise arithmetic values are byte-swapped on the way in
+// and out (whole ranges with SIMD shuffles), and zero-copy views are only
+// available for single-byte elements. Only arithmetic and enum values and
+// fixed-size arrays of them are bitwise-serializable here: any other type
+// needs an io() or save()/load().
+struct BigEndianFormat {
+  static constexpr bool kVarintIntegers = false;
+  static constexpr ByteOrder kByteOrder = ByteOrder::kBig;
+};
+
+struct LittleEndianFormat {
+  static constexpr bool kVarintIntegers = false;
+  static constexpr ByteOrder kByteOrder = ByteOrder::kLittle;
+};
+
+// Sinks own the bytes written by a BasicBinaryOutputSerializer. A sink
+// provides:
+//   void write(const void* data, std::size_t size);
+//   void write_zeros(std::size_t size);
+//   void finish(std::size_t total);  // |total| includes the header
+//   result();                        // whatever get_result() hands back
+// Sinks backed by memory may also provide
+//   char* claim(std::size_t size);
+// handing out the next |size| bytes to be written in place, and sinks that
+// can keep pointers to the caller's containers instead of copying them
+//   void reference(const void* data, std::size_t size);
+// which is used for contiguous payloads (vectors, arrays, strings).
+
+// Appends to a growable buffer.
+class VectorSink {
  public:
-  BinaryOutputSerializer() : OutputSerializer<BinaryOutputSerializer>(this) {
+  VectorSink() = default;
+  // Reserves |capacity| bytes up front, e.g. as counted by a
+  // SizeCountingSerializer.
+  explicit VectorSink(std::size_t capacity) { buffer_.reserve(capacity); }
+
+  void write(const void* data, std::size_t size) {
+    const auto* src = static_cast<const char*>(data);
+    buffer_.insert(buffer_.end(), src, src + size);
+  }
+
+  void write_zeros(std::size_t size) {
+    buffer_.resize(buffer_.size() + size);
+  }
+
+  // Hands out the next |size| bytes to be written in place.
+  char* claim(std::size_t size) {
+    const auto offset = buffer_.size();
+    buffer_.resize(offset + size);
+    return buffer_.data() + offset;
+  }
+
+  void finish(std::size_t total) {
+    detail::store_header(buffer_.data(), total);
+  }
+
+  // The finished archive; callers may move it out.
+  std::vector<char>& result() { return buffer_; }
+
+ private:
+  std::vector<char> buffer_;
+};
+
+// Writes into a caller-supplied buffer, typically sized up front with
+// SizeCountingSink, so there is no growth on the write path; writing past
+// the end throws instead.
+class FixedBufferSink {
+ public:
+  FixedBufferSink(char* data, std::size_t capacity)
+      : begin_(data), cur_(data), end_(data + capacity) {}
+
+  void write(const void* data, std::size_t size) {
+    if (size > 0) {
+      std::memcpy(claim(size), data, size);
+    }
+  }
+
+  void write_zeros(std::size_t size) { std::memset(claim(size), 0, size); }
+
+  // Hands out the next |size| bytes to be written in place.
+  char* claim(std::size_t size) {
+    if (size > static_cast<std::size_t>(end_ - cur_)) {
+      throw std::out_of_range("binary archive: buffer too small");
+    }
+    auto* dst = cur_;
+    cur_ += size;
+    return dst;
+  }
+
+  void finish(std::size_t total) { detail::store_header(begin_, total); }
+
+  std::size_t result() const { return cur_ - begin_; }
+
+ private:
+  char* const begin_;
+  char* cur_;
+  char* const end_;
+};
+
+// Discards the bytes; only the archive size is kept.
+class SizeCountingSink {
+ public:
+  void write(const void*, std::size_t) {}
+  void write_zeros(std::size_t) {}
+  void finish(std::size_t total) { total_ = total; }
+
+  std::size_t result() const { return total_; }
+
+ private:
+  std::size_t total_{0};
+};
+
+namespace detail {
+
+// Whether the sink can hand out space to be written in place.
+template <class Sink, class = void>
+struct CanClaim : std::false_type {};
+
+template <class Sink>
+struct CanClaim<Sink, std::void_t<decltype(std::declval<Sink&>().claim(
+                          std::size_t{}))>> : std::true_type {};
+
+// Whether the sink can keep a pointer to the caller's bytes.
+template <class Sink, class = void>
+struct CanReference : std::false_type {};
+
+template <class Sink>
+struct CanReference<Sink, std::void_t<decltype(std::declval<Sink&>().reference(
+                              nullptr, std::size_t{}))>> : std::true_type {};
+
+// Defined with the fixed-layout walkers below.
+template <class S, class T>
+bool save_fixed(S& ser, const T* data, std::size_t count);
+template <class S, class T>
+bool load_fixed(S& ser, T* data, std::size_t count);
+
+}  // namespace detail
+
+// Archive layout: an 8-byte little-endian header holding the total archive
+// size, followed by the fields in the order they were saved. Sinks that
+// cannot go back to fill in the header leave it 0, meaning the archive runs
+// to the end of its buffer.
+// Contiguous arithmetic payloads are padded to their alignment (relative to
+// the archive start), so that a reader whose buffer is suitably aligned can
+// hand them out as views.
+template <class Sink, class FormatType = NativeFormat>
+class BasicBinaryOutputSerializer
+    : public OutputSerializer<BasicBinaryOutputSerializer<Sink, FormatType>> {
+ public:
+  using Format = FormatType;
+
+  template <class... Args>
+  explicit BasicBinaryOutputSerializer(Args&&... args)
+      : OutputSerializer<BasicBinaryOutputSerializer<Sink, FormatType>>(this),
+        sink_(std::forward<Args>(args)...) {
     constexpr int kSize = sizeof(head_);
-    buffer_.resize(kSize);
+    sink_.write_zeros(kSize);
     head_ = kSize;
   }
 
   void save_binary(const void* data, std::size_t size) {
-    const auto nxt = head_ + size;
-    if (nxt >= buffer_.size()) {
-      buffer_.resize(nxt);
+    sink_.write(data, size);
+    head_ += size;
+  }
+
+  // Writes |size| bytes of |width|-byte words in the format's byte order.
+  // |data| is a contiguous payload of the caller's, which sinks that can
+  // reference it do not copy.
+  void save_words(const void* data, std::size_t size, std::size_t width) {
+    if constexpr (FormatType::kByteOrder != kHostByteOrder) {
+      if (width > 1) {
+        const auto* src = static_cast<const char*>(data);
+        alignas(32) char buffer[kSwapBufferSize];
+        while (size > 0) {
+          const auto n = std::min(size, kSwapBufferSize);
+          detail::byteswap_copy(buffer, src, n, width);
+          save_binary(buffer, n);
+          src += n;
+          size -= n;
+        }
+        return;
+      }
+    }
+    if constexpr (detail::CanReference<Sink>::value) {
+      sink_.reference(data, size);
+      head_ += size;
+    } else {
+      save_binary(data, size);
+    }
+  }
+
+  // Zero-pads up to the next multiple of |alignment|.
+  void align(std::size_t alignment) {
+    const auto nxt = (head_ + alignment - 1) / alignment * alignment;
+    sink_.write_zeros(nxt - head_);
+    head_ = nxt;
+  }
+
+  // Hands out the next |size| bytes of the archive to be written in place.
+  // Needs a sink that can claim.
+  char* claim_binary(std::size_t size) {
+    auto* dst = sink_.claim(size);
+    head_ += size;
+    return dst;
+  }
+
+  std::size_t size() const { return head_; }
+
+  // Hook called by OutputSerializer for types with an io(). Values whose io()
+  // only visits fixed-width fields are written through a single claim.
+  template <class T>
+  void invoke_io(T& val) {
+    if constexpr (detail::CanClaim<Sink>::value) {
+      if (detail::save_fixed(*this, &val, 1)) {
+        return;
+      }
+    }
+    OutputSerializer<BasicBinaryOutputSerializer<Sink, FormatType>>::invoke_io(
+        val);
+  }
+
+  // Stamps the header (where the sink can) and returns the sink's result: the
+  // archive itself for VectorSink, its size for the other sinks.
+  decltype(auto) get_result() {
+    sink_.finish(head_);
+    return sink_.result();
+  }
+
+ private:
+  // A multiple of every word width, so that no word straddles two chunks.
+  static constexpr std::size_t kSwapBufferSize = 4096;
+
+  std::size_t head_{0};
+  Sink sink_;
+};
+
+using BinaryOutputSerializer = BasicBinaryOutputSerializer<VectorSink>;
+using CompactBinaryOutputSerializer =
+    BasicBinaryOutputSerializer<VectorSink, CompactFormat>;
+// Walks the same io()/save() overloads as BinaryOutputSerializer without
+// writing anything, to size the archive ahead of time.
+using SizeCountingSerializer = BasicBinaryOutputSerializer<SizeCountingSink>;
+
+// Sources feed a BasicBinaryInputSerializer. A source provides:
+//   void read(void* data, std::size_t size);
+//   void skip(std::size_t size);
+//   void expect(std::size_t size);  // throws if |size| more bytes can't exist
+//   void set_archive_size(std::size_t total);  // from the header
+// Sources that hold the whole archive in memory also provide
+//   const char* view(std::size_t size);
+//   std::size_t remaining() const;
+//   void seek(std::size_t offset);  // from the start of the archive
+// which is what makes zero-copy loads (ArrayView, std::string_view) possible.
+
+// Reads out of a caller-owned buffer without copying it.
+class BufferSource {
+ public:
+  BufferSource(const char* data, std::size_t size) : data_(data), size_(size) {}
+  explicit BufferSource(const std::vector<char>& buffer)
+      : BufferSource(buffer.data(), buffer.size()) {}
+
+  void read(void* data, std::size_t size) {
+    const auto* src = view(size);
+    // |data| may be null when |size| is 0, e.g. for an empty vector.
+    if (size > 0) {
+      std::memcpy(data, src, size);
     }
-    auto* dst = buffer_.data() + head_;
+  }
+
+  void skip(std::size_t size) { view(size); }
+
+  void expect(std::size_t size) {
+    if (size > remaining()) {
+      throw std::out_of_range("binary archive: read past end");
+    }
+  }
+
+  void set_archive_size(std::size_t total) {
+    if (total == 0) {
+      return;
+    }
+    if (total < head_ || total > size_) {
+      throw std::out_of_range("binary archive: bad header");
+    }
+    size_ = total;
+  }
+
+  // Consumes |size| bytes and returns a pointer to them inside the buffer.
+  const char* view(std::size_t size) {
+    expect(size);
+    const auto* src = data_ + head_;
+    head_ += size;
+    return src;
+  }
+
+  std::size_t remaining() const { return size_ - head_; }
+
+  void seek(std::size_t offset) {
+    if (offset > size_) {
+      throw std::out_of_range("binary archive: seek past end");
+    }
+    head_ = offset;
+  }
+
+ private:
+  const char* data_{nullptr};
+  std::size_t size_{0};
+  std::size_t head_{0};
+};
+
+namespace detail {
+
+// Whether the source can hand out pointers into its buffer.
+template <class Source, class = void>
+struct HasView : std::false_type {};
+
+template <class Source>
+struct HasView<Source, std::void_t<decltype(std::declval<Source&>().view(
+                           std::size_t{}))>> : std::true_type {};
+
+}  // namespace detail
+
+// Decodes an archive produced by a BasicBinaryOutputSerializer. With
+// BufferSource, nothing is copied up front and views handed out by
+// view_binary() point into the caller's buffer.
+template <class Source, class FormatType = NativeFormat>
+class BasicBinaryInputSerializer
+    : public InputSerializer<BasicBinaryInputSerializer<Source, FormatType>> {
+ public:
+  using Format = FormatType;
+
+  template <class... Args>
+  explicit BasicBinaryInputSerializer(Args&&... args)
+      : InputSerializer<BasicBinaryInputSerializer<Source, FormatType>>(this),
+        source_(std::forward<Args>(args)...) {
+    char header[sizeof(std::uint64_t)];
+    load_binary(header, sizeof(header));
+    source_.set_archive_size(detail::load_header(header));
+  }
+
+  void load_binary(void* data, std::size_t size) {
+    source_.read(data, size);
+    head_ += size;
+  }
+
+  // Reads |size| bytes of |width|-byte words stored in the format's byte
+  // order. In-memory sources are swapped straight out of the buffer.
+  void load_words(void* data, std::size_t size, std::size_t width) {
+    if constexpr (FormatType::kByteOrder == kHostByteOrder) {
+      load_binary(data, size);
+    } else {
+      auto* dst = static_cast<char*>(data);
+      if constexpr (detail::HasView<Source>::value) {
+        if (size > 0) {
+          detail::byteswap_copy(dst, view_binary(size), size, width);
+        }
+      } else {
+        load_binary(dst, size);
+        detail::byteswap_copy(dst, dst, size, width);
+      }
+    }
+  }
+
+  void align(std::size_t alignment) {
+    const auto nxt = (head_ + alignment - 1) / alignment * alignment;
+    source_.skip(nxt - head_);
     head_ = nxt;
-    std::memcpy(dst, data, size);
+  }
+
+  // Throws unless |count| elements of T can still be read, so that a corrupt
+  // length is caught before anything is allocated for it.
+  template <class T>
+  void expect_array(std::size_t count) {
+    if (count > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+      throw std::out_of_range("binary archive: bad array length");
+    }
+    source_.expect(count * sizeof(T));
+  }
+
+  // Aligns for T and reads |count| contiguous elements of it into |data|.
+  template <class T>
+  void load_array(T* data, std::size_t count) {
+    align(alignof(T));
+    expect_array<T>(count);
+    load_words(data, count * sizeof(T), sizeof(detail::ScalarOfT<T>));
+  }
+
+  // Consumes |size| bytes and returns a pointer to them inside the archive.
+  const char* view_binary(std::size_t size) {
+    const auto* src = source_.view(size);
+    head_ += size;
+    return src;
+  }
+
+  // Aligns for T and consumes |count| contiguous elements of it.
+  template <class T>
+  const T* view_array(std::size_t count) {
+    align(alignof(T));
+    expect_array<T>(count);
+    const auto* src = view_binary(count * sizeof(T));
+    assert(reinterpret_cast<std::uintptr_t>(src) % alignof(T) == 0);
+    return reinterpret_cast<const T*>(src);
+  }
+
+  std::size_t remaining() const { return source_.remaining(); }
+
+  // Offset of the next byte to be read from the start of the archive.
+  std::size_t position() const { return head_; }
+
+  // Hook called by InputSerializer for types with an io(). Values whose io()
+  // only visits fixed-width fields are read out of a single view.
+  template <class T>
+  void invoke_io(T& val) {
+    if constexpr (detail::HasView<Source>::value) {
+      if (detail::load_fixed(*this, &val, 1)) {
+        return;
+      }
+    }
+    InputSerializer<BasicBinaryInputSerializer<Source, FormatType>>::invoke_io(
+        val);
+  }
+
+  // Jumps to |offset| bytes from the start of the archive, e.g. one taken
+  // from the output serializer's size() while saving.
+  void seek(std::size_t offset) {
+    source_.seek(offset);
+    head_ = offset;
   }
 
  private:
   std::size_t head_{0};
-  std::vector<char> buffer_;
+  Source source_;
 };
 
-// class BinaryInputSerializer : public InputSerializer<BinaryInputSerializer> {
-//  public:
-//   BinaryInputSerializer() : InputSerializer<BinaryInputSerializer>(this) {
-//     constexpr int kSize = sizeof(head_);
-//     buffer_.resize(kSize);
-//     head_ = kSize;
-//   }
-
-//   void save_binary(const void* data, std::size_t size) {
-//     const auto nxt = head_ + size;
-//     if (nxt >= buffer_.size()) {
-//       buffer_.resize(nxt);
-//     }
-//     auto* dst = buffer_.data() + head_;
-//     head_ = nxt;
-//     std::memcpy(dst, data, size);
-//   }
-
-//  private:
-//   std::size_t head_{0};
-//   std::vector<char> buffer_;
-// };
+using BinaryInputSerializer = BasicBinaryInputSerializer<BufferSource>;
+using CompactBinaryInputSerializer =
+    BasicBinaryInputSerializer<BufferSource, CompactFormat>;
+
+namespace detail {
+
+// Ranges of T that are encoded as one length prefix plus one memcpy.
+// std::vector<bool> has no contiguous storage, so it keeps the per-element
+// path.
+// Under a varint format, integer ranges are encoded element by element too.
+// Under a foreign byte order, only ranges of arithmetic values (or arrays of
+// them) can be swapped wholesale; a struct's fields would need its layout.
+template <class S, class T>
+inline constexpr bool kIsBulkRange =
+    traits::IsBitwiseSerializable<S, T>::value && !std::is_same_v<T, bool> &&
+    !(std::is_integral_v<T> && S::Format::kVarintIntegers) &&
+    (S::Format::kByteOrder == kHostByteOrder ||
+     std::is_arithmetic_v<ScalarOfT<T>> || std::is_enum_v<ScalarOfT<T>>);
+
+template <class T>
+inline constexpr bool kIsVarint = std::is_integral_v<T> &&
+                                  !std::is_same_v<T, bool> && sizeof(T) > 1;
+
+// Maps signed integers to unsigned ones so that small magnitudes of either
+// sign get short varints: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+template <class T>
+inline std::make_unsigned_t<T> zigzag_encode(T t) {
+  using U = std::make_unsigned_t<T>;
+  return (static_cast<U>(t) << 1) ^
+         static_cast<U>(t >> (std::numeric_limits<T>::digits));
+}
+
+template <class T>
+inline T zigzag_decode(std::make_unsigned_t<T> u) {
+  return static_cast<T>((u >> 1) ^ (~(u & 1) + 1));
+}
+
+// LEB128: seven bits per byte, least significant group first, with the high
+// bit set on every byte but the last.
+template <class S, class U>
+inline void save_varint(S& ser, U u) {
+  std::uint8_t bytes[(sizeof(U) * 8 + 6) / 7];
+  std::size_t n = 0;
+  while (u >= 0x80) {
+    bytes[n++] = static_cast<std::uint8_t>(u) | 0x80;
+    u >>= 7;
+  }
+  bytes[n++] = static_cast<std::uint8_t>(u);
+  ser.save_binary(bytes, n);
+}
+
+template <class U, class S>
+inline U load_varint(S& ser) {
+  U u = 0;
+  for (unsigned shift = 0; shift < sizeof(U) * 8; shift += 7) {
+    std::uint8_t byte = 0;
+    ser.load_binary(&byte, 1);
+    u |= static_cast<U>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return u;
+    }
+  }
+  throw std::out_of_range("binary archive: varint too long");
+}
+
+// Fixed layouts: values whose encoded size is a compile-time constant. Their
+// encoding is the same as field by field, but saving one is a single claim
+// from the sink plus straight-line stores, and loading one a single bounds
+// check plus straight-line loads. The sizes come from the field types alone,
+// so nothing is walked before writing; a type lists its fields for this with
+// ti_io_fields() (see TI_IO_FIELDS), which must match what its io() visits.
+template <class Format, class T>
+inline constexpr bool kIsFixedScalar =
+    (std::is_arithmetic_v<T> || std::is_enum_v<T>) &&
+    !(Format::kVarintIntegers && kIsVarint<T>);
 
 template <class T>
-inline typename std::enable_if<std::is_arithmetic_v<T>, void>::type save(
-    BinaryOutputSerializer& ser, const T& t) {
-  ser.save_binary(std::addressof(t), sizeof(t));
+struct IsStdArray : std::false_type {};
+
+template <class T, std::size_t N>
+struct IsStdArray<std::array<T, N>> : std::true_type {};
+
+template <class T, class = void>
+struct HasIoFields : std::false_type {};
+
+template <class T>
+struct HasIoFields<
+    T, std::void_t<decltype(std::declval<const T&>().ti_io_fields())>>
+    : std::true_type {};
+
+template <class T>
+using IoFieldsOf = decltype(std::declval<const T&>().ti_io_fields());
+
+template <class T>
+using ElementOf = std::remove_cv_t<
+    std::remove_reference_t<decltype(std::declval<const T&>()[0])>>;
+
+inline constexpr std::size_t kNotFixed =
+    std::numeric_limits<std::size_t>::max();
+
+template <class S, class T>
+constexpr std::size_t fixed_end(std::size_t offset);
+
+template <class S, class Fields>
+struct FixedFieldsEnd;
+
+template <class S, class... Fs>
+struct FixedFieldsEnd<S, std::tuple<Fs...>> {
+  static constexpr std::size_t from(std::size_t offset) {
+    ((offset = fixed_end<S, std::remove_cv_t<std::remove_reference_t<Fs>>>(
+          offset)),
+     ...);
+    return offset;
+  }
+};
+
+// Where a T laid out from |offset| ends, or kNotFixed if its encoded size
+// can vary. Arrays of bulk elements are padded to their alignment as they
+// are field by field, so offsets are taken from a start aligned to
+// fixed_align<S, T>().
+template <class S, class T>
+constexpr std::size_t fixed_end(std::size_t offset) {
+  if (offset == kNotFixed) {
+    return kNotFixed;
+  }
+  if constexpr (kIsFixedScalar<typename S::Format, T>) {
+    return offset + sizeof(T);
+  } else if constexpr (std::is_array_v<T> || IsStdArray<T>::value) {
+    using E = ElementOf<T>;
+    if constexpr (kIsBulkRange<S, E>) {
+      return (offset + alignof(E) - 1) / alignof(E) * alignof(E) + sizeof(T);
+    } else {
+      for (std::size_t i = 0; i < sizeof(T) / sizeof(E); ++i) {
+        offset = fixed_end<S, E>(offset);
+      }
+      return offset;
+    }
+  } else if constexpr (HasIoFields<T>::value) {
+    return FixedFieldsEnd<S, IoFieldsOf<T>>::from(offset);
+  } else {
+    return kNotFixed;
+  }
+}
+
+template <class S, class T>
+constexpr std::size_t fixed_align();
+
+template <class S, class Fields>
+struct FixedFieldsAlign;
+
+template <class S, class... Fs>
+struct FixedFieldsAlign<S, std::tuple<Fs...>> {
+  static constexpr std::size_t value = std::max(
+      {std::size_t{1},
+       fixed_align<S, std::remove_cv_t<std::remove_reference_t<Fs>>>()...});
+};
+
+// The alignment fixed_end() takes its offsets from: the widest alignment of
+// any bulk array inside T, 1 if there is none.
+template <class S, class T>
+constexpr std::size_t fixed_align() {
+  if constexpr (std::is_array_v<T> || IsStdArray<T>::value) {
+    using E = ElementOf<T>;
+    if constexpr (kIsBulkRange<S, E>) {
+      return alignof(E);
+    } else {
+      return fixed_align<S, E>();
+    }
+  } else if constexpr (HasIoFields<T>::value) {
+    return FixedFieldsAlign<S, IoFieldsOf<T>>::value;
+  } else {
+    return 1;
+  }
+}
+
+// The encoded size of T under serializer S if it is the same for every value
+// starting at a multiple of fixed_align<S, T>(), 0 otherwise. Fixed-width
+// arithmetic and enum values, fixed-size arrays of fixed-size elements and
+// types whose ti_io_fields() all have fixed sizes qualify.
+template <class S, class T>
+constexpr std::size_t fixed_size() {
+  constexpr auto end = fixed_end<S, T>(0);
+  return end == kNotFixed ? 0 : end;
+}
+
+// Stores |t| at |offset| from |base|, which is aligned as fixed_size()
+// assumes, and returns the offset past it.
+template <class S, class T>
+std::size_t store_fixed(char* base, std::size_t offset, const T& t) {
+  using Format = typename S::Format;
+  if constexpr (kIsFixedScalar<Format, T>) {
+    const auto u = to_byte_order<Format::kByteOrder>(t);
+    std::memcpy(base + offset, &u, sizeof(u));
+    return offset + sizeof(u);
+  } else if constexpr (std::is_array_v<T> || IsStdArray<T>::value) {
+    using E = ElementOf<T>;
+    if constexpr (kIsBulkRange<S, E>) {
+      const auto begin = (offset + alignof(E) - 1) / alignof(E) * alignof(E);
+      std::memset(base + offset, 0, begin - offset);
+      const auto* src = reinterpret_cast<const char*>(&t);
+      if constexpr (Format::kByteOrder == kHostByteOrder) {
+        std::memcpy(base + begin, src, sizeof(T));
+      } else {
+        byteswap_copy(base + begin, src, sizeof(T), sizeof(ScalarOfT<E>));
+      }
+      return begin + sizeof(T);
+    } else {
+      for (const auto& e : t) {
+        offset = store_fixed<S>(base, offset, e);
+      }
+      return offset;
+    }
+  } else {
+    std::apply(
+        [&](const auto&... fields) {
+          ((offset = store_fixed<S>(base, offset, fields)), ...);
+        },
+        t.ti_io_fields());
+    return offset;
+  }
+}
+
+// Loads what store_fixed() stored. ti_io_fields() may only be const, so the
+// fields are written through const_cast.
+template <class S, class T>
+std::size_t load_fixed_value(const char* base, std::size_t offset, T& t) {
+  using Format = typename S::Format;
+  if constexpr (kIsFixedScalar<Format, T>) {
+    std::memcpy(&t, base + offset, sizeof(T));
+    t = to_byte_order<Format::kByteOrder>(t);
+    return offset + sizeof(T);
+  } else if constexpr (std::is_array_v<T> || IsStdArray<T>::value) {
+    using E = ElementOf<T>;
+    if constexpr (kIsBulkRange<S, E>) {
+      const auto begin = (offset + alignof(E) - 1) / alignof(E) * alignof(E);
+      auto* dst = reinterpret_cast<char*>(&t);
+      if constexpr (Format::kByteOrder == kHostByteOrder) {
+        std::memcpy(dst, base + begin, sizeof(T));
+      } else {
+        byteswap_copy(dst, base + begin, sizeof(T), sizeof(ScalarOfT<E>));
+      }
+      return begin + sizeof(T);
+    } else {
+      for (auto& e : t) {
+        offset = load_fixed_value<S>(base, offset, e);
+      }
+      return offset;
+    }
+  } else {
+    std::apply(
+        [&](const auto&... fields) {
+          ((offset = load_fixed_value<S>(
+                base, offset,
+                const_cast<std::remove_const_t<
+                    std::remove_reference_t<decltype(fields)>>&>(fields))),
+           ...);
+        },
+        t.ti_io_fields());
+    return offset;
+  }
+}
+
+// Whether |count| Ts can be laid out back to back from |position| as
+// fixed_size() sized them: the first must start aligned as it assumes, and
+// so must every one after it.
+template <class S, class T>
+bool fits_fixed_layout(std::size_t position, std::size_t count) {
+  constexpr auto kSize = fixed_size<S, T>();
+  constexpr auto kAlign = fixed_align<S, T>();
+  if constexpr (kSize == 0) {
+    return false;
+  } else if constexpr (kAlign == 1) {
+    return true;
+  } else {
+    return position % kAlign == 0 && (count <= 1 || kSize % kAlign == 0);
+  }
+}
+
+// Writes |count| values through one claim if T has a fixed layout. Returns
+// false, having written nothing, otherwise.
+template <class S, class T>
+bool save_fixed(S& ser, const T* data, std::size_t count) {
+  constexpr auto kSize = fixed_size<S, T>();
+  if constexpr (kSize == 0) {
+    return false;
+  } else {
+    if (!fits_fixed_layout<S, T>(ser.size(), count)) {
+      return false;
+    }
+    auto* dst = ser.claim_binary(kSize * count);
+    for (std::size_t i = 0; i < count; ++i) {
+      store_fixed<S>(dst + kSize * i, 0, data[i]);
+    }
+    return true;
+  }
+}
+
+// Reads |count| values out of one view if T has a fixed layout. Returns
+// false, having read nothing, otherwise.
+template <class S, class T>
+bool load_fixed(S& ser, T* data, std::size_t count) {
+  constexpr auto kSize = fixed_size<S, T>();
+  if constexpr (kSize == 0) {
+    return false;
+  } else {
+    // Too short an archive is left to the field-by-field path to report.
+    if (!fits_fixed_layout<S, T>(ser.position(), count) ||
+        count > ser.remaining() / kSize) {
+      return false;
+    }
+    const auto* src = ser.view_binary(kSize * count);
+    for (std::size_t i = 0; i < count; ++i) {
+      load_fixed_value<S>(src + kSize * i, 0, data[i]);
+    }
+    return true;
+  }
+}
+
+}  // namespace detail
+
+template <class Sink, class Format, class T>
+inline typename std::enable_if<std::is_arithmetic_v<T> || std::is_enum_v<T>,
+                               void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser, const T& t) {
+  if constexpr (Format::kVarintIntegers && detail::kIsVarint<T>) {
+    if constexpr (std::is_signed_v<T>) {
+      detail::save_varint(ser, detail::zigzag_encode(t));
+    } else {
+      detail::save_varint(ser, t);
+    }
+  } else {
+    const auto u = detail::to_byte_order<Format::kByteOrder>(t);
+    ser.save_binary(std::addressof(u), sizeof(u));
+  }
+}
+
+template <class Sink, class Format, class T>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryOutputSerializer<Sink, Format>, T>,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser, const ArrayView<T>& view) {
+  ser(view.size());
+  ser.align(alignof(T));
+  ser.save_words(view.data(), view.size() * sizeof(T),
+                 sizeof(detail::ScalarOfT<T>));
+}
+
+template <class Sink, class Format, class T, class A>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryOutputSerializer<Sink, Format>, T>,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+     const std::vector<T, A>& vec) {
+  save(ser, ArrayView<T>(vec.data(), vec.size()));
+}
+
+// Vectors of values with a fixed layout (see detail::fixed_size) are written
+// as one packed block.
+template <class Sink, class Format, class T, class A>
+inline typename std::enable_if<
+    detail::CanClaim<Sink>::value &&
+        !detail::kIsBulkRange<BasicBinaryOutputSerializer<Sink, Format>, T> &&
+        detail::HasIoFields<T>::value &&
+        detail::fixed_size<BasicBinaryOutputSerializer<Sink, Format>, T>() !=
+            0,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+     const std::vector<T, A>& vec) {
+  ser(vec.size());
+  if (!detail::save_fixed(ser, vec.data(), vec.size())) {
+    for (const auto& t : vec) {
+      ser(t);
+    }
+  }
+}
+
+// Byte strings are encoded like a std::vector<char>: length, then the bytes.
+template <class Sink, class Format, class C, class Tr, class A>
+inline typename std::enable_if<sizeof(C) == 1, void>::type save(
+    BasicBinaryOutputSerializer<Sink, Format>& ser,
+    const std::basic_string<C, Tr, A>& str) {
+  ser(str.size());
+  ser.save_words(str.data(), str.size(), 1);
+}
+
+// Fixed-size arrays carry no length prefix.
+template <class Sink, class Format, class T, std::size_t N>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryOutputSerializer<Sink, Format>, T>,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+     const std::array<T, N>& arr) {
+  ser.align(alignof(T));
+  ser.save_words(arr.data(), sizeof(arr), sizeof(detail::ScalarOfT<T>));
+}
+
+template <class Sink, class Format, class T, std::size_t N>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryOutputSerializer<Sink, Format>, T>,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser, const T (&arr)[N]) {
+  ser.align(alignof(T));
+  ser.save_words(arr, sizeof(arr), sizeof(detail::ScalarOfT<T>));
+}
+
+template <class Source, class Format, class T>
+inline typename std::enable_if<std::is_arithmetic_v<T> || std::is_enum_v<T>,
+                               void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser, T& t) {
+  if constexpr (Format::kVarintIntegers && detail::kIsVarint<T>) {
+    const auto u = detail::load_varint<std::make_unsigned_t<T>>(ser);
+    if constexpr (std::is_signed_v<T>) {
+      t = detail::zigzag_decode<T>(u);
+    } else {
+      t = u;
+    }
+  } else {
+    ser.load_binary(std::addressof(t), sizeof(t));
+    t = detail::to_byte_order<Format::kByteOrder>(t);
+  }
+}
+
+// Zero-copy: |view| ends up pointing into the archive buffer, which must be
+// aligned to at least alignof(T). Needs an in-memory source, and the host
+// byte order unless T is a single byte.
+template <class Source, class Format, class T>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryInputSerializer<Source, Format>, T>,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser, ArrayView<T>& view) {
+  static_assert(Format::kByteOrder == kHostByteOrder ||
+                    sizeof(detail::ScalarOfT<T>) == 1,
+                "zero-copy views need the host byte order");
+  std::size_t size = 0;
+  ser(size);
+  view = ArrayView<T>(ser.template view_array<T>(size), size);
+}
+
+template <class Source, class Format, class T, class A>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryInputSerializer<Source, Format>, T>,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser,
+     std::vector<T, A>& vec) {
+  std::size_t size = 0;
+  ser(size);
+  ser.template expect_array<T>(size);
+  vec.resize(size);
+  ser.load_array(vec.data(), size);
+}
+
+template <class Source, class Format, class T, class A>
+inline typename std::enable_if<
+    detail::HasView<Source>::value &&
+        !detail::kIsBulkRange<BasicBinaryInputSerializer<Source, Format>, T> &&
+        detail::HasIoFields<T>::value &&
+        detail::fixed_size<BasicBinaryInputSerializer<Source, Format>, T>() !=
+            0,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser,
+     std::vector<T, A>& vec) {
+  std::size_t size = 0;
+  ser(size);
+  vec.resize(size);
+  if (!detail::load_fixed(ser, vec.data(), vec.size())) {
+    for (auto& t : vec) {
+      ser(t);
+    }
+  }
+}
+
+// Decodes straight into the string's own storage, which comes from its
+// allocator (e.g. an arena for std::pmr::string).
+template <class Source, class Format, class C, class Tr, class A>
+inline typename std::enable_if<sizeof(C) == 1, void>::type load(
+    BasicBinaryInputSerializer<Source, Format>& ser,
+    std::basic_string<C, Tr, A>& str) {
+  std::size_t size = 0;
+  ser(size);
+  ser.template expect_array<C>(size);
+  str.resize(size);
+  ser.load_binary(str.data(), size);
+}
+
+template <class Source, class Format, class T, std::size_t N>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryInputSerializer<Source, Format>, T>,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser, std::array<T, N>& arr) {
+  ser.load_array(arr.data(), N);
+}
+
+template <class Source, class Format, class T, std::size_t N>
+inline typename std::enable_if<
+    detail::kIsBulkRange<BasicBinaryInputSerializer<Source, Format>, T>,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser, T (&arr)[N]) {
+  ser.load_array(arr, N);
+}
+
+template <class Source, class Format>
+inline void load(BasicBinaryInputSerializer<Source, Format>& ser,
+                 std::string_view& str) {
+  ArrayView<char> view;
+  load(ser, view);
+  str = std::string_view(view.data(), view.size());
+}
+
+namespace detail {
+
+// Maps whose keys and values are both bulk-encodable are stored as two
+// columns: the count, then all keys and then all values, each laid out like
+// a std::array of them. Nothing is written per entry but the bytes, and the
+// reader makes one bounds check per column.
+template <class S, class K, class V>
+inline constexpr bool kIsColumnarMap = kIsBulkRange<S, K> && kIsBulkRange<S, V>;
+
+template <bool Keys, class Sink, class Format, class M>
+void save_column(BasicBinaryOutputSerializer<Sink, Format>& ser, const M& map) {
+  using T = std::conditional_t<Keys, typename M::key_type,
+                               typename M::mapped_type>;
+  constexpr std::size_t kPerChunk = std::max<std::size_t>(1, 4096 / sizeof(T));
+  alignas(T) char chunk[kPerChunk * sizeof(T)];
+  std::size_t n = 0;
+  const auto flush = [&] {
+    if constexpr (Format::kByteOrder != kHostByteOrder) {
+      byteswap_copy(chunk, chunk, n * sizeof(T), sizeof(ScalarOfT<T>));
+    }
+    ser.save_binary(chunk, n * sizeof(T));
+    n = 0;
+  };
+  ser.align(alignof(T));
+  for (const auto& kv : map) {
+    if constexpr (Keys) {
+      std::memcpy(chunk + n * sizeof(T), &kv.first, sizeof(T));
+    } else {
+      std::memcpy(chunk + n * sizeof(T), &kv.second, sizeof(T));
+    }
+    if (++n == kPerChunk) {
+      flush();
+    }
+  }
+  flush();
+}
+
+template <class Sink, class Format, class M>
+void save_columnar_map(BasicBinaryOutputSerializer<Sink, Format>& ser,
+                       const M& map) {
+  ser(map.size());
+  save_column<true>(ser, map);
+  save_column<false>(ser, map);
+}
+
+template <class Format, class T>
+T load_element(const char* src) {
+  T t;
+  std::memcpy(&t, src, sizeof(T));
+  if constexpr (Format::kByteOrder != kHostByteOrder) {
+    auto* p = reinterpret_cast<char*>(&t);
+    byteswap_copy(p, p, sizeof(T), sizeof(ScalarOfT<T>));
+  }
+  return t;
+}
+
+template <class Source, class Format, class M>
+void load_columnar_map(BasicBinaryInputSerializer<Source, Format>& ser,
+                       M& map) {
+  using K = typename M::key_type;
+  using V = typename M::mapped_type;
+  std::size_t size = 0;
+  ser(size);
+  if constexpr (HasView<Source>::value) {
+    ser.align(alignof(K));
+    ser.template expect_array<K>(size);
+    const char* keys = ser.view_binary(size * sizeof(K));
+    ser.align(alignof(V));
+    ser.template expect_array<V>(size);
+    const char* values = ser.view_binary(size * sizeof(V));
+    prepare_map(map, size);
+    for (std::size_t i = 0; i < size; ++i) {
+      insert_loaded(map, load_element<Format, K>(keys + i * sizeof(K)),
+                    load_element<Format, V>(values + i * sizeof(V)));
+    }
+  } else {
+    std::vector<K> keys;
+    std::vector<V> values;
+    ser.template expect_array<K>(size);
+    keys.resize(size);
+    ser.load_array(keys.data(), size);
+    ser.template expect_array<V>(size);
+    values.resize(size);
+    ser.load_array(values.data(), size);
+    prepare_map(map, size);
+    for (std::size_t i = 0; i < size; ++i) {
+      insert_loaded(map, keys[i], values[i]);
+    }
+  }
+}
+
+}  // namespace detail
+
+template <class Sink, class Format, class K, class V, class C, class A>
+inline typename std::enable_if<
+    detail::kIsColumnarMap<BasicBinaryOutputSerializer<Sink, Format>, K, V>,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+     const std::map<K, V, C, A>& map) {
+  detail::save_columnar_map(ser, map);
+}
+
+template <class Sink, class Format, class K, class V, class H, class E,
+          class A>
+inline typename std::enable_if<
+    detail::kIsColumnarMap<BasicBinaryOutputSerializer<Sink, Format>, K, V>,
+    void>::type
+save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+     const std::unordered_map<K, V, H, E, A>& map) {
+  detail::save_columnar_map(ser, map);
+}
+
+template <class Source, class Format, class K, class V, class C, class A>
+inline typename std::enable_if<
+    detail::kIsColumnarMap<BasicBinaryInputSerializer<Source, Format>, K, V>,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser,
+     std::map<K, V, C, A>& map) {
+  detail::load_columnar_map(ser, map);
+}
+
+template <class Source, class Format, class K, class V, class H, class E,
+          class A>
+inline typename std::enable_if<
+    detail::kIsColumnarMap<BasicBinaryInputSerializer<Source, Format>, K, V>,
+    void>::type
+load(BasicBinaryInputSerializer<Source, Format>& ser,
+     std::unordered_map<K, V, H, E, A>& map) {
+  detail::load_columnar_map(ser, map);
+}
+
+// Two-phase save: sizes the archive with a SizeCountingSerializer first, so
+// the output is allocated exactly once and written without growth checks.
+template <class Format = NativeFormat, class... Args>
+std::size_t serialized_size(const Args&... args) {
+  BasicBinaryOutputSerializer<SizeCountingSink, Format> counter;
+  counter(args...);
+  return counter.get_result();
+}
+
+// Returns the bytes written; throws std::out_of_range if |size| is less than
+// serialized_size(args...).
+template <class Format = NativeFormat, class... Args>
+std::size_t serialize_into(char* data, std::size_t size, const Args&... args) {
+  BasicBinaryOutputSerializer<FixedBufferSink, Format> ser(data, size);
+  ser(args...);
+  return ser.get_result();
+}
+
+template <class Format = NativeFormat, class... Args>
+std::vector<char> serialize(const Args&... args) {
+  std::vector<char> buffer(serialized_size<Format>(args...));
+  serialize_into<Format>(buffer.data(), buffer.size(), args...);
+  return buffer;
 }
 
 }  // namespace taichi
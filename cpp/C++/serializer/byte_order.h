@@ -0,0 +1,231 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define TI_SERIALIZER_X86_SIMD
+#endif
+
+namespace taichi {
+
+enum class ByteOrder { kLittle, kBig };
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+inline constexpr ByteOrder kHostByteOrder = ByteOrder::kBig;
+#else
+inline constexpr ByteOrder kHostByteOrder = ByteOrder::kLittle;
+#endif
+
+namespace detail {
+
+// The arithmetic type a fixed-size array bottoms out at, i.e. the unit whose
+// bytes get reversed.
+template <class T>
+struct ScalarOf {
+  using type = T;
+};
+
+template <class T, std::size_t N>
+struct ScalarOf<std::array<T, N>> : ScalarOf<T> {};
+
+template <class T, std::size_t N>
+struct ScalarOf<T[N]> : ScalarOf<T> {};
+
+template <class T>
+using ScalarOfT = typename ScalarOf<std::remove_cv_t<T>>::type;
+
+// Compilers turn these into single bswap instructions.
+inline std::uint16_t bswap(std::uint16_t v) {
+  return static_cast<std::uint16_t>(v << 8 | v >> 8);
+}
+
+inline std::uint32_t bswap(std::uint32_t v) {
+  return v << 24 | (v << 8 & 0xff0000u) | (v >> 8 & 0xff00u) | v >> 24;
+}
+
+inline std::uint64_t bswap(std::uint64_t v) {
+  return std::uint64_t{bswap(static_cast<std::uint32_t>(v))} << 32 |
+         bswap(static_cast<std::uint32_t>(v >> 32));
+}
+
+template <std::size_t W>
+struct UintOfSize;
+template <>
+struct UintOfSize<2> {
+  using type = std::uint16_t;
+};
+template <>
+struct UintOfSize<4> {
+  using type = std::uint32_t;
+};
+template <>
+struct UintOfSize<8> {
+  using type = std::uint64_t;
+};
+
+template <class T>
+T byteswap(T t) {
+  if constexpr (sizeof(T) == 1) {
+    return t;
+  } else {
+    typename UintOfSize<sizeof(T)>::type u;
+    std::memcpy(&u, &t, sizeof(t));
+    u = bswap(u);
+    std::memcpy(&t, &u, sizeof(t));
+    return t;
+  }
+}
+
+template <ByteOrder Order, class T>
+T to_byte_order(T t) {
+  if constexpr (Order == kHostByteOrder) {
+    return t;
+  } else {
+    return byteswap(t);
+  }
+}
+
+template <std::size_t W>
+void byteswap_copy_scalar(char* dst, const char* src, std::size_t size) {
+  using U = typename UintOfSize<W>::type;
+  for (std::size_t i = 0; i < size; i += W) {
+    U u;
+    std::memcpy(&u, src + i, W);
+    u = bswap(u);
+    std::memcpy(dst + i, &u, W);
+  }
+}
+
+#ifdef TI_SERIALIZER_X86_SIMD
+// pshufb control reversing every W-byte word of a 16-byte lane, repeated for
+// both lanes of an AVX2 register.
+template <std::size_t W>
+struct SwapMask {
+  alignas(32) char bytes[32];
+
+  constexpr SwapMask() : bytes() {
+    for (std::size_t i = 0; i < 32; ++i) {
+      bytes[i] = static_cast<char>((i % 16) / W * W + (W - 1 - i % W));
+    }
+  }
+};
+
+template <std::size_t W>
+inline constexpr SwapMask<W> kSwapMask{};
+
+template <std::size_t W>
+__attribute__((target("ssse3"))) void byteswap_copy_ssse3(char* dst,
+                                                         const char* src,
+                                                         std::size_t size) {
+  const auto mask =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(kSwapMask<W>.bytes));
+  std::size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_shuffle_epi8(v, mask));
+  }
+  byteswap_copy_scalar<W>(dst + i, src + i, size - i);
+}
+
+template <std::size_t W>
+__attribute__((target("avx2"))) void byteswap_copy_avx2(char* dst,
+                                                       const char* src,
+                                                       std::size_t size) {
+  const auto mask =
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(kSwapMask<W>.bytes));
+  std::size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    const auto v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_shuffle_epi8(v, mask));
+  }
+  byteswap_copy_ssse3<W>(dst + i, src + i, size - i);
+}
+
+inline bool cpu_has_avx2() {
+  static const bool has = __builtin_cpu_supports("avx2");
+  return has;
+}
+
+inline bool cpu_has_ssse3() {
+  static const bool has = __builtin_cpu_supports("ssse3");
+  return has;
+}
+#endif
+
+template <std::size_t W>
+void byteswap_copy(char* dst, const char* src, std::size_t size) {
+#ifdef TI_SERIALIZER_X86_SIMD
+  if (cpu_has_avx2()) {
+    byteswap_copy_avx2<W>(dst, src, size);
+    return;
+  }
+  if (cpu_has_ssse3()) {
+    byteswap_copy_ssse3<W>(dst, src, size);
+    return;
+  }
+#endif
+  byteswap_copy_scalar<W>(dst, src, size);
+}
+
+// Copies |size| bytes from |src| to |dst|, reversing the bytes of every
+// |width|-byte word. |dst| may equal |src|.
+inline void byteswap_copy(char* dst, const char* src, std::size_t size,
+                          std::size_t width) {
+  assert(size % width == 0);
+  switch (width) {
+    case 2:
+      byteswap_copy<2>(dst, src, size);
+      break;
+    case 4:
+      byteswap_copy<4>(dst, src, size);
+      break;
+    case 8:
+      byteswap_copy<8>(dst, src, size);
+      break;
+    default:
+      assert(width == 1);
+      if (dst != src) {
+        std::memmove(dst, src, size);
+      }
+  }
+}
+
+// Archive headers (the 8-byte archive size) are little-endian whatever the
+// format's byte order, so any reader can find out how large an archive is.
+inline void store_header(char* dst, std::uint64_t size) {
+  size = to_byte_order<ByteOrder::kLittle>(size);
+  std::memcpy(dst, &size, sizeof(size));
+}
+
+inline std::uint64_t load_header(const char* src) {
+  std::uint64_t size = 0;
+  std::memcpy(&size, src, sizeof(size));
+  return to_byte_order<ByteOrder::kLittle>(size);
+}
+
+// The offset tables, counts and trailers that the indexed, compressed,
+// checksummed and parallel archives append are little-endian as well.
+template <class T>
+void store_le(char* dst, T t) {
+  t = to_byte_order<ByteOrder::kLittle>(t);
+  std::memcpy(dst, &t, sizeof(t));
+}
+
+template <class T>
+T load_le(const char* src) {
+  T t;
+  std::memcpy(&t, src, sizeof(t));
+  return to_byte_order<ByteOrder::kLittle>(t);
+}
+
+}  // namespace detail
+}  // namespace taichi
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define TI_SERIALIZER_HW_CRC32C
+#endif
+
+#include "binary.h"
+
+namespace taichi {
+namespace detail {
+
+// Slicing-by-8 tables for the reflected CRC32C (Castagnoli) polynomial.
+struct Crc32cTables {
+  std::uint32_t t[8][256];
+
+  Crc32cTables() {
+    for (std::uint32_t i = 0; i < 256; ++i) {
+      std::uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = c & 1 ? (c >> 1) ^ 0x82f63b78u : c >> 1;
+      }
+      t[0][i] = c;
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (int i = 0; i < 256; ++i) {
+        t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+      }
+    }
+  }
+};
+
+inline const Crc32cTables& crc32c_tables() {
+  static const Crc32cTables tables;
+  return tables;
+}
+
+// The *_update functions work on the raw (uninverted) CRC state. The
+// slicing tables index bytes in stream order, so words are loaded
+// little-endian whatever the host.
+inline std::uint32_t crc32c_update_sw(std::uint32_t crc, const char* p,
+                                      std::size_t n) {
+  const auto& t = crc32c_tables().t;
+  for (; n >= 8; p += 8, n -= 8) {
+    const auto w = load_le<std::uint64_t>(p) ^ crc;
+    crc = t[7][w & 0xff] ^ t[6][(w >> 8) & 0xff] ^ t[5][(w >> 16) & 0xff] ^
+          t[4][(w >> 24) & 0xff] ^ t[3][(w >> 32) & 0xff] ^
+          t[2][(w >> 40) & 0xff] ^ t[1][(w >> 48) & 0xff] ^ t[0][w >> 56];
+  }
+  for (; n > 0; ++p, --n) {
+    crc = (crc >> 8) ^ t[0][(crc ^ static_cast<std::uint8_t>(*p)) & 0xff];
+  }
+  return crc;
+}
+
+inline std::uint32_t crc32c_copy_sw(char* dst, const char* src, std::size_t n,
+                                    std::uint32_t crc) {
+  std::memcpy(dst, src, n);
+  return crc32c_update_sw(crc, src, n);
+}
+
+#ifdef TI_SERIALIZER_HW_CRC32C
+// SSE4.2 crc32 instructions, selected at run time so that the build does
+// not need -msse4.2.
+__attribute__((target("sse4.2"))) inline std::uint32_t crc32c_update_hw(
+    std::uint32_t crc, const char* p, std::size_t n) {
+  std::uint64_t c = crc;
+  for (; n >= 8; p += 8, n -= 8) {
+    std::uint64_t w = 0;
+    std::memcpy(&w, p, sizeof(w));
+    c = _mm_crc32_u64(c, w);
+  }
+  crc = static_cast<std::uint32_t>(c);
+  for (; n > 0; ++p, --n) {
+    crc = _mm_crc32_u8(crc, static_cast<std::uint8_t>(*p));
+  }
+  return crc;
+}
+
+// Checksums each word on its way from |src| to |dst|, in one pass.
+__attribute__((target("sse4.2"))) inline std::uint32_t crc32c_copy_hw(
+    char* dst, const char* src, std::size_t n, std::uint32_t crc) {
+  std::uint64_t c = crc;
+  for (; n >= 8; src += 8, dst += 8, n -= 8) {
+    std::uint64_t w = 0;
+    std::memcpy(&w, src, sizeof(w));
+    std::memcpy(dst, &w, sizeof(w));
+    c = _mm_crc32_u64(c, w);
+  }
+  crc = static_cast<std::uint32_t>(c);
+  for (; n > 0; ++src, ++dst, --n) {
+    *dst = *src;
+    crc = _mm_crc32_u8(crc, static_cast<std::uint8_t>(*src));
+  }
+  return crc;
+}
+
+inline bool cpu_has_crc32c() {
+  static const bool has = __builtin_cpu_supports("sse4.2");
+  return has;
+}
+#endif
+
+inline std::uint32_t crc32c_update(std::uint32_t crc, const char* p,
+                                   std::size_t n) {
+#ifdef TI_SERIALIZER_HW_CRC32C
+  if (cpu_has_crc32c()) {
+    return crc32c_update_hw(crc, p, n);
+  }
+#endif
+  return crc32c_update_sw(crc, p, n);
+}
+
+inline std::uint32_t crc32c_copy(char* dst, const char* src, std::size_t n,
+                                 std::uint32_t crc) {
+#ifdef TI_SERIALIZER_HW_CRC32C
+  if (cpu_has_crc32c()) {
+    return crc32c_copy_hw(dst, src, n, crc);
+  }
+#endif
+  return crc32c_copy_sw(dst, src, n, crc);
+}
+
+// Stored field by field, little-endian, like the CRCs before it.
+struct ChecksumTrailer {
+  std::uint64_t raw_size;
+  std::uint64_t block_size;
+  std::uint64_t num_blocks;
+
+  void store(char* dst) const {
+    store_le(dst, raw_size);
+    store_le(dst + 8, block_size);
+    store_le(dst + 16, num_blocks);
+  }
+
+  static ChecksumTrailer load(const char* src) {
+    return {load_le<std::uint64_t>(src), load_le<std::uint64_t>(src + 8),
+            load_le<std::uint64_t>(src + 16)};
+  }
+};
+
+}  // namespace detail
+
+// CRC32C of |size| bytes. Pass a previous result as |crc| to continue it.
+inline std::uint32_t crc32c(const void* data, std::size_t size,
+                            std::uint32_t crc = 0) {
+  return ~detail::crc32c_update(~crc, static_cast<const char*>(data), size);
+}
+
+inline constexpr std::size_t kDefaultChecksumBlockSize = 1 << 16;
+
+// Checksummed framing: the archive passes through unchanged, cut into
+// fixed-size blocks whose CRC32Cs are appended after it, followed by the raw
+// archive size, the block size and the block count (8 bytes each), all
+// little-endian. The
+// archive header is checksummed as 0 and then holds the size of the whole
+// container, so the archive stays contiguous and readable in place.
+//
+// Sinks that provide claim() get the checksum computed in the same pass
+// that copies the bytes into them; others get it right after the write,
+// while the bytes are still in cache.
+template <class Sink>
+class ChecksummedSink {
+ public:
+  explicit ChecksummedSink(Sink sink = Sink(),
+                           std::size_t block_size = kDefaultChecksumBlockSize)
+      : sink_(std::move(sink)), block_size_(block_size) {
+    // Block 0 must cover the whole header; see ChecksummedSource::verify().
+    if (block_size_ < sizeof(std::uint64_t)) {
+      throw std::invalid_argument("bad checksum block size");
+    }
+  }
+
+  void write(const void* data, std::size_t size) {
+    const auto* src = static_cast<const char*>(data);
+    // One write or claim, so that growable sinks do not grow block by block.
+    char* dst = nullptr;
+    if constexpr (detail::CanClaim<Sink>::value) {
+      dst = sink_.claim(size);
+    } else {
+      sink_.write(src, size);
+    }
+    while (size > 0) {
+      const auto n = std::min(size, block_size_ - in_block_);
+      if constexpr (detail::CanClaim<Sink>::value) {
+        crc_ = detail::crc32c_copy(dst, src, n, crc_);
+        dst += n;
+      } else {
+        crc_ = detail::crc32c_update(crc_, src, n);
+      }
+      advance(n);
+      src += n;
+      size -= n;
+    }
+  }
+
+  void write_zeros(std::size_t size) {
+    static constexpr char kZeros[256] = {};
+    while (size > 0) {
+      const auto n = std::min({size, block_size_ - in_block_, sizeof(kZeros)});
+      crc_ = detail::crc32c_update(crc_, kZeros, n);
+      sink_.write_zeros(n);
+      advance(n);
+      size -= n;
+    }
+  }
+
+  // get_result() may call this more than once; the trailer goes out once.
+  void finish(std::size_t total) {
+    if (finished_) {
+      return;
+    }
+    finished_ = true;
+    if (in_block_ > 0) {
+      close_block();
+    }
+    const detail::ChecksumTrailer trailer{total, block_size_, crcs_.size()};
+    char encoded[sizeof(trailer)];
+    trailer.store(encoded);
+    sink_.write(crcs_.data(), crcs_.size() * sizeof(std::uint32_t));
+    sink_.write(encoded, sizeof(encoded));
+    sink_.finish(total + crcs_.size() * sizeof(std::uint32_t) +
+                 sizeof(trailer));
+  }
+
+  decltype(auto) result() { return sink_.result(); }
+
+ private:
+  void advance(std::size_t n) {
+    in_block_ += n;
+    if (in_block_ == block_size_) {
+      close_block();
+    }
+  }
+
+  void close_block() {
+    crcs_.push_back(detail::to_byte_order<ByteOrder::kLittle>(~crc_));
+    crc_ = ~std::uint32_t{0};
+    in_block_ = 0;
+  }
+
+  Sink sink_;
+  std::size_t block_size_;
+  std::size_t in_block_{0};
+  std::uint32_t crc_{~std::uint32_t{0}};
+  std::vector<std::uint32_t> crcs_;  // little-endian
+  bool finished_{false};
+};
+
+// Reads a checksummed container in place. Each block is verified the first
+// time any of its bytes is read or viewed, right before decoding uses them,
+// so an archive is only checked as far as it is actually decoded. Supports
+// zero-copy loads and seek() like BufferSource.
+class ChecksummedSource {
+ public:
+  ChecksummedSource(const char* data, std::size_t size) : data_(data) {
+    std::uint64_t container_size = 0;
+    if (size < sizeof(container_size) + sizeof(detail::ChecksumTrailer)) {
+      throw std::out_of_range("binary archive: missing checksum trailer");
+    }
+    container_size = detail::load_header(data);
+    const std::size_t end = container_size == 0 ? size : container_size;
+    if (end > size || end < sizeof(container_size) + sizeof(trailer_)) {
+      throw std::out_of_range("binary archive: bad header");
+    }
+    trailer_ = detail::ChecksumTrailer::load(data + end - sizeof(trailer_));
+    const auto& t = trailer_;
+    const auto room = end - sizeof(trailer_);
+    if (t.block_size < sizeof(container_size) ||
+        t.raw_size < sizeof(container_size) ||
+        t.raw_size > room ||
+        t.num_blocks != (t.raw_size + t.block_size - 1) / t.block_size ||
+        t.num_blocks > (room - t.raw_size) / sizeof(std::uint32_t)) {
+      throw std::out_of_range("binary archive: bad checksum trailer");
+    }
+    crcs_ = data + t.raw_size;
+    size_ = t.raw_size;
+    verified_.assign(t.num_blocks, false);
+  }
+
+  explicit ChecksummedSource(const std::vector<char>& buffer)
+      : ChecksummedSource(buffer.data(), buffer.size()) {}
+
+  void read(void* data, std::size_t size) {
+    const auto* src = view(size);
+    if (size > 0) {
+      std::memcpy(data, src, size);
+    }
+  }
+
+  void skip(std::size_t size) {
+    expect(size);
+    head_ += size;
+  }
+
+  void expect(std::size_t size) {
+    if (size > remaining()) {
+      throw std::out_of_range("binary archive: read past end");
+    }
+  }
+
+  // The header holds the container size, which the trailer already gave.
+  void set_archive_size(std::size_t) {}
+
+  const char* view(std::size_t size) {
+    expect(size);
+    verify(head_, head_ + size);
+    const auto* src = data_ + head_;
+    head_ += size;
+    return src;
+  }
+
+  std::size_t remaining() const { return size_ - head_; }
+
+  void seek(std::size_t offset) {
+    if (offset > size_) {
+      throw std::out_of_range("binary archive: seek past end");
+    }
+    head_ = offset;
+  }
+
+  // Checks every block up front.
+  void verify_all() { verify(0, size_); }
+
+ private:
+  // Verifies the blocks overlapping [begin, end) that have not been yet.
+  void verify(std::size_t begin, std::size_t end) {
+    if (begin == end) {
+      return;
+    }
+    const auto block_size = trailer_.block_size;
+    for (auto i = begin / block_size; i <= (end - 1) / block_size; ++i) {
+      if (verified_[i]) {
+        continue;
+      }
+      const auto first = i * block_size;
+      const auto len = std::min<std::size_t>(block_size, size_ - first);
+      std::uint32_t crc = 0;
+      if (i == 0) {
+        // The header was checksummed before it was stamped.
+        const std::uint64_t zero = 0;
+        crc = crc32c(&zero, sizeof(zero));
+        crc = crc32c(data_ + sizeof(zero), len - sizeof(zero), crc);
+      } else {
+        crc = crc32c(data_ + first, len);
+      }
+      const auto expected =
+          detail::load_le<std::uint32_t>(crcs_ + i * sizeof(std::uint32_t));
+      if (crc != expected) {
+        throw std::out_of_range("binary archive: checksum mismatch");
+      }
+      verified_[i] = true;
+    }
+  }
+
+  const char* data_{nullptr};
+  const char* crcs_{nullptr};
+  std::size_t size_{0};
+  std::size_t head_{0};
+  detail::ChecksumTrailer trailer_{};
+  std::vector<bool> verified_;
+};
+
+using ChecksummedBinaryOutputSerializer =
+    BasicBinaryOutputSerializer<ChecksummedSink<VectorSink>>;
+using ChecksummedBinaryInputSerializer =
+    BasicBinaryInputSerializer<ChecksummedSource>;
+
+}  // namespace taichi
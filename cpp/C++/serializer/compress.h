@@ -0,0 +1,526 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef TI_SERIALIZER_WITH_ZSTD
+#include <zstd.h>
+
+#include <memory>
+#endif
+
+#include "binary.h"
+#include "parallel.h"
+
+namespace taichi {
+
+// Block compression between a binary serializer and its sink. The archive
+// is cut into fixed-size blocks that are compressed independently, so they
+// can be decompressed in parallel, or one at a time as a reader touches
+// them.
+//
+// Container layout: an 8-byte header holding the container size, then per
+// block its raw and stored sizes (4 bytes each) and the stored bytes, then
+// the block offsets, the raw archive size, the block size, the codec ID and
+// the block count, 8 bytes each. A block that does not shrink is stored raw
+// (stored size == raw size).
+//
+// A codec provides:
+//   static constexpr std::uint64_t kId;
+//   static std::size_t max_compressed_size(std::size_t size);
+//   static std::size_t compress(const char* src, std::size_t size, char* dst,
+//                               std::size_t capacity);  // returns the size
+//   static void decompress(const char* src, std::size_t size, char* dst,
+//                          std::size_t raw_size);  // throws if corrupt
+
+inline constexpr std::size_t kDefaultBlockSize = 1 << 16;
+
+// LZ77 in the style of LZ4: greedy matching through a hash table of 4-byte
+// sequences, no entropy coding. Each sequence is a token (literal length in
+// the high nibble, match length - 4 in the low one, 15 meaning "more bytes
+// follow"), the literals, and a 2-byte little-endian match offset; the last
+// sequence has literals only.
+struct LzCodec {
+  static constexpr std::uint64_t kId = 1;
+
+  static std::size_t max_compressed_size(std::size_t size) {
+    return size + size / 255 + 16;
+  }
+
+  static std::size_t compress(const char* src, std::size_t size, char* dst,
+                              std::size_t capacity) {
+    if (capacity < max_compressed_size(size)) {
+      throw std::invalid_argument("lz: output buffer too small");
+    }
+    // Reused per thread like ZstdCodec's contexts; only cleared per block.
+    thread_local std::vector<std::uint32_t> table(kHashSize);
+    std::fill(table.begin(), table.end(), 0);
+    char* op = dst;
+    std::size_t anchor = 0;
+    std::size_t i = 0;
+    while (i + kMinMatch <= size) {
+      const auto seq = load32(src + i);
+      auto& slot = table[hash(seq)];
+      const std::size_t candidate = slot;
+      slot = static_cast<std::uint32_t>(i);
+      if (candidate < i && i - candidate <= kMaxOffset &&
+          load32(src + candidate) == seq) {
+        std::size_t len = kMinMatch;
+        while (i + len < size && src[candidate + len] == src[i + len]) {
+          ++len;
+        }
+        op = emit(op, src + anchor, i - anchor, i - candidate, len);
+        i += len;
+        anchor = i;
+      } else {
+        ++i;
+      }
+    }
+    op = emit(op, src + anchor, size - anchor, 0, 0);
+    return op - dst;
+  }
+
+  static void decompress(const char* src, std::size_t size, char* dst,
+                         std::size_t raw_size) {
+    const auto* ip = reinterpret_cast<const std::uint8_t*>(src);
+    const auto* const iend = ip + size;
+    char* op = dst;
+    char* const oend = dst + raw_size;
+    while (ip < iend) {
+      const unsigned token = *ip++;
+      const auto lit = read_length(ip, iend, token >> 4);
+      if (lit > static_cast<std::size_t>(iend - ip) ||
+          lit > static_cast<std::size_t>(oend - op)) {
+        throw std::out_of_range("binary archive: corrupt lz block");
+      }
+      if (lit > 0) {
+        std::memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+      }
+      if (ip == iend) {
+        break;
+      }
+      if (iend - ip < 2) {
+        throw std::out_of_range("binary archive: corrupt lz block");
+      }
+      const std::size_t offset = ip[0] | ip[1] << 8;
+      ip += 2;
+      const auto len = read_length(ip, iend, token & 15) + kMinMatch;
+      if (offset == 0 || offset > static_cast<std::size_t>(op - dst) ||
+          len > static_cast<std::size_t>(oend - op)) {
+        throw std::out_of_range("binary archive: corrupt lz block");
+      }
+      const char* match = op - offset;
+      if (offset >= len) {
+        std::memcpy(op, match, len);
+        op += len;
+      } else {
+        // Overlapping: the match repeats bytes it is producing.
+        for (std::size_t k = 0; k < len; ++k) {
+          *op++ = match[k];
+        }
+      }
+    }
+    if (op != oend) {
+      throw std::out_of_range("binary archive: corrupt lz block");
+    }
+  }
+
+ private:
+  static constexpr std::size_t kMinMatch = 4;
+  static constexpr std::size_t kMaxOffset = 65535;
+  static constexpr int kHashBits = 14;
+  static constexpr std::size_t kHashSize = std::size_t{1} << kHashBits;
+
+  static std::uint32_t load32(const char* p) {
+    std::uint32_t v = 0;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static std::size_t hash(std::uint32_t seq) {
+    return (seq * 2654435761u) >> (32 - kHashBits);
+  }
+
+  static char* write_length(char* op, std::size_t len) {
+    for (; len >= 255; len -= 255) {
+      *op++ = static_cast<char>(255);
+    }
+    *op++ = static_cast<char>(len);
+    return op;
+  }
+
+  static std::size_t read_length(const std::uint8_t*& ip,
+                                 const std::uint8_t* iend, std::size_t len) {
+    if (len != 15) {
+      return len;
+    }
+    std::uint8_t byte = 0;
+    do {
+      if (ip == iend) {
+        throw std::out_of_range("binary archive: corrupt lz block");
+      }
+      byte = *ip++;
+      len += byte;
+    } while (byte == 255);
+    return len;
+  }
+
+  // A match length of 0 marks the final, literals-only sequence.
+  static char* emit(char* op, const char* lit, std::size_t lit_len,
+                    std::size_t offset, std::size_t match_len) {
+    const std::size_t ml = match_len == 0 ? 0 : match_len - kMinMatch;
+    char* token = op++;
+    *token = static_cast<char>(std::min<std::size_t>(lit_len, 15) << 4 |
+                               std::min<std::size_t>(ml, 15));
+    if (lit_len >= 15) {
+      op = write_length(op, lit_len - 15);
+    }
+    if (lit_len > 0) {
+      std::memcpy(op, lit, lit_len);
+      op += lit_len;
+    }
+    if (match_len == 0) {
+      return op;
+    }
+    *op++ = static_cast<char>(offset & 0xff);
+    *op++ = static_cast<char>(offset >> 8);
+    if (ml >= 15) {
+      op = write_length(op, ml - 15);
+    }
+    return op;
+  }
+};
+
+#ifdef TI_SERIALIZER_WITH_ZSTD
+// Zstandard, when the build found it. Contexts are reused per thread.
+struct ZstdCodec {
+  static constexpr std::uint64_t kId = 2;
+  static constexpr int kLevel = 3;
+
+  static std::size_t max_compressed_size(std::size_t size) {
+    return ZSTD_compressBound(size);
+  }
+
+  static std::size_t compress(const char* src, std::size_t size, char* dst,
+                              std::size_t capacity) {
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> ctx(
+        ZSTD_createCCtx(), &ZSTD_freeCCtx);
+    const auto n = ZSTD_compressCCtx(ctx.get(), dst, capacity, src, size,
+                                     kLevel);
+    if (ZSTD_isError(n)) {
+      throw std::runtime_error(ZSTD_getErrorName(n));
+    }
+    return n;
+  }
+
+  static void decompress(const char* src, std::size_t size, char* dst,
+                         std::size_t raw_size) {
+    thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> ctx(
+        ZSTD_createDCtx(), &ZSTD_freeDCtx);
+    const auto n = ZSTD_decompressDCtx(ctx.get(), dst, raw_size, src, size);
+    if (ZSTD_isError(n) || n != raw_size) {
+      throw std::out_of_range("binary archive: corrupt zstd block");
+    }
+  }
+};
+#endif
+
+namespace detail {
+
+// Both are stored field by field, little-endian, like the block offsets.
+struct BlockHeader {
+  std::uint32_t raw_size;
+  std::uint32_t stored_size;
+
+  void store(char* dst) const {
+    store_le(dst, raw_size);
+    store_le(dst + 4, stored_size);
+  }
+
+  static BlockHeader load(const char* src) {
+    return {load_le<std::uint32_t>(src), load_le<std::uint32_t>(src + 4)};
+  }
+};
+
+// Block offsets precede these.
+struct CompressedTrailer {
+  std::uint64_t raw_size;
+  std::uint64_t block_size;
+  std::uint64_t codec;
+  std::uint64_t num_blocks;
+
+  void store(char* dst) const {
+    store_le(dst, raw_size);
+    store_le(dst + 8, block_size);
+    store_le(dst + 16, codec);
+    store_le(dst + 24, num_blocks);
+  }
+
+  static CompressedTrailer load(const char* src) {
+    return {load_le<std::uint64_t>(src), load_le<std::uint64_t>(src + 8),
+            load_le<std::uint64_t>(src + 16), load_le<std::uint64_t>(src + 24)};
+  }
+};
+
+}  // namespace detail
+
+// Compresses everything written through it into |Sink|, one block at a time.
+template <class Sink, class Codec = LzCodec>
+class CompressingSink {
+ public:
+  explicit CompressingSink(Sink sink = Sink(),
+                           std::size_t block_size = kDefaultBlockSize)
+      : sink_(std::move(sink)) {
+    if (block_size == 0 ||
+        block_size > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::invalid_argument("bad compression block size");
+    }
+    block_.reserve(block_size);
+    block_size_ = block_size;
+    sink_.write_zeros(sizeof(std::uint64_t));
+    written_ = sizeof(std::uint64_t);
+  }
+
+  void write(const void* data, std::size_t size) {
+    const auto* src = static_cast<const char*>(data);
+    while (size > 0) {
+      const auto n = std::min(size, block_size_ - block_.size());
+      block_.insert(block_.end(), src, src + n);
+      src += n;
+      size -= n;
+      if (block_.size() == block_size_) {
+        flush_block();
+      }
+    }
+  }
+
+  void write_zeros(std::size_t size) {
+    while (size > 0) {
+      const auto n = std::min(size, block_size_ - block_.size());
+      block_.resize(block_.size() + n);
+      size -= n;
+      if (block_.size() == block_size_) {
+        flush_block();
+      }
+    }
+  }
+
+  // The raw archive's own header is left 0, i.e. "runs to the end".
+  // get_result() may call this more than once; the trailer goes out once.
+  void finish(std::size_t total) {
+    if (finished_) {
+      return;
+    }
+    finished_ = true;
+    if (!block_.empty()) {
+      flush_block();
+    }
+    const detail::CompressedTrailer trailer{total, block_size_, Codec::kId,
+                                            offsets_.size()};
+    char encoded[sizeof(trailer)];
+    trailer.store(encoded);
+    put(offsets_.data(), offsets_.size() * sizeof(std::uint64_t));
+    put(encoded, sizeof(encoded));
+    sink_.finish(written_);
+  }
+
+  decltype(auto) result() { return sink_.result(); }
+
+ private:
+  void flush_block() {
+    offsets_.push_back(
+        detail::to_byte_order<ByteOrder::kLittle>(std::uint64_t{written_}));
+    compressed_.resize(Codec::max_compressed_size(block_.size()));
+    auto stored_size = Codec::compress(block_.data(), block_.size(),
+                                       compressed_.data(), compressed_.size());
+    const char* stored = compressed_.data();
+    if (stored_size >= block_.size()) {
+      stored_size = block_.size();
+      stored = block_.data();
+    }
+    const detail::BlockHeader header{static_cast<std::uint32_t>(block_.size()),
+                                     static_cast<std::uint32_t>(stored_size)};
+    char encoded[sizeof(header)];
+    header.store(encoded);
+    put(encoded, sizeof(encoded));
+    put(stored, stored_size);
+    block_.clear();
+  }
+
+  void put(const void* data, std::size_t size) {
+    sink_.write(data, size);
+    written_ += size;
+  }
+
+  Sink sink_;
+  std::size_t block_size_{0};
+  std::size_t written_{0};
+  std::vector<char> block_;
+  std::vector<char> compressed_;
+  std::vector<std::uint64_t> offsets_;  // little-endian
+  bool finished_{false};
+};
+
+// An in-memory compressed container, decompressed block by block on demand.
+template <class Codec = LzCodec>
+class CompressedArchive {
+ public:
+  CompressedArchive(const char* data, std::size_t size) : data_(data) {
+    std::uint64_t container_size = 0;
+    if (size < sizeof(container_size) + sizeof(detail::CompressedTrailer)) {
+      throw std::out_of_range("binary archive: missing compression trailer");
+    }
+    container_size = detail::load_header(data);
+    const std::size_t end = container_size == 0 ? size : container_size;
+    if (end > size ||
+        end < sizeof(container_size) + sizeof(detail::CompressedTrailer)) {
+      throw std::out_of_range("binary archive: bad header");
+    }
+    trailer_ = detail::CompressedTrailer::load(data + end - sizeof(trailer_));
+    const auto& t = trailer_;
+    const auto max_blocks = (end - sizeof(container_size) - sizeof(t)) /
+                            sizeof(std::uint64_t);
+    if (t.codec != Codec::kId) {
+      throw std::out_of_range("binary archive: unexpected codec");
+    }
+    if (t.block_size == 0 || t.num_blocks > max_blocks ||
+        t.num_blocks != (t.raw_size + t.block_size - 1) / t.block_size) {
+      throw std::out_of_range("binary archive: bad compression trailer");
+    }
+    table_ = data + end - sizeof(t) - t.num_blocks * sizeof(std::uint64_t);
+  }
+
+  explicit CompressedArchive(const std::vector<char>& buffer)
+      : CompressedArchive(buffer.data(), buffer.size()) {}
+
+  std::size_t raw_size() const { return trailer_.raw_size; }
+  std::size_t block_size() const { return trailer_.block_size; }
+  std::size_t num_blocks() const { return trailer_.num_blocks; }
+
+  // Decompresses block |i| into |dst|, which has room for block_size().
+  // Returns the block's raw size.
+  std::size_t decompress_block(std::size_t i, char* dst) const {
+    const auto offset =
+        detail::load_le<std::uint64_t>(table_ + i * sizeof(std::uint64_t));
+    const std::size_t limit = table_ - data_;
+    if (offset < sizeof(std::uint64_t) ||
+        offset > limit - sizeof(detail::BlockHeader)) {
+      throw std::out_of_range("binary archive: bad block offset");
+    }
+    const auto header = detail::BlockHeader::load(data_ + offset);
+    const auto raw_size =
+        std::min(block_size(), this->raw_size() - i * block_size());
+    if (header.raw_size != raw_size ||
+        header.stored_size > limit - offset - sizeof(header)) {
+      throw std::out_of_range("binary archive: bad block header");
+    }
+    const char* stored = data_ + offset + sizeof(header);
+    if (header.stored_size == header.raw_size) {
+      std::memcpy(dst, stored, raw_size);
+    } else {
+      Codec::decompress(stored, header.stored_size, dst, raw_size);
+    }
+    return raw_size;
+  }
+
+  // The whole raw archive, with blocks decompressed concurrently.
+  std::vector<char> decompress(
+      std::size_t num_threads = detail::default_num_threads()) const {
+    std::vector<char> raw(raw_size());
+    detail::parallel_for(num_blocks(), num_threads, [&](std::size_t i) {
+      decompress_block(i, raw.data() + i * block_size());
+    });
+    return raw;
+  }
+
+ private:
+  const char* data_{nullptr};
+  const char* table_{nullptr};
+  detail::CompressedTrailer trailer_{};
+};
+
+// Reads a compressed container through a BasicBinaryInputSerializer,
+// decompressing only the blocks that are read or seeked into. It cannot
+// hand out views, so zero-copy types (ArrayView, std::string_view, Lazy,
+// IndexedView) need the archive from CompressedArchive::decompress().
+template <class Codec = LzCodec>
+class CompressedSource {
+ public:
+  CompressedSource(const char* data, std::size_t size)
+      : archive_(data, size),
+        size_(archive_.raw_size()),
+        block_(archive_.block_size()) {}
+  explicit CompressedSource(const std::vector<char>& buffer)
+      : CompressedSource(buffer.data(), buffer.size()) {}
+
+  void read(void* data, std::size_t size) {
+    expect(size);
+    auto* dst = static_cast<char*>(data);
+    while (size > 0) {
+      const auto i = head_ / archive_.block_size();
+      if (i != current_) {
+        archive_.decompress_block(i, block_.data());
+        current_ = i;
+      }
+      const auto begin = head_ - i * archive_.block_size();
+      const auto n = std::min(size, archive_.block_size() - begin);
+      std::memcpy(dst, block_.data() + begin, n);
+      dst += n;
+      head_ += n;
+      size -= n;
+    }
+  }
+
+  void skip(std::size_t size) {
+    expect(size);
+    head_ += size;
+  }
+
+  void expect(std::size_t size) {
+    if (size > remaining()) {
+      throw std::out_of_range("binary archive: read past end");
+    }
+  }
+
+  void set_archive_size(std::size_t total) {
+    if (total == 0) {
+      return;
+    }
+    if (total < head_ || total > size_) {
+      throw std::out_of_range("binary archive: bad header");
+    }
+    size_ = total;
+  }
+
+  std::size_t remaining() const { return size_ - head_; }
+
+  void seek(std::size_t offset) {
+    if (offset > size_) {
+      throw std::out_of_range("binary archive: seek past end");
+    }
+    head_ = offset;
+  }
+
+ private:
+  static constexpr std::size_t kNoBlock = -1;
+
+  CompressedArchive<Codec> archive_;
+  std::size_t size_{0};
+  std::size_t head_{0};
+  std::vector<char> block_;
+  std::size_t current_{kNoBlock};
+};
+
+using CompressedBinaryOutputSerializer =
+    BasicBinaryOutputSerializer<CompressingSink<VectorSink>>;
+using CompressedBinaryInputSerializer =
+    BasicBinaryInputSerializer<CompressedSource<>>;
+
+}  // namespace taichi
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "binary.h"
+
+namespace taichi {
+
+// Delta checkpoints: a DeltaWriter saves the same root object over and over,
+// but only writes the parts of it that changed since its previous save.
+//
+// Each top-level field of the root (each value its io() hands to the
+// serializer; the root itself if it has no io()) is encoded as an embedded
+// archive of its own. The encoding is cut into fixed-size chunks, and each
+// chunk's fingerprint is remembered. The next save only writes the chunks
+// whose fingerprint changed, so editing a few elements of a large container
+// costs a few chunks rather than the whole container.
+//
+// Snapshot layout: sequence number (0 for a full base snapshot), chunk size,
+// field count, then per field its encoded size, a change map with one bit
+// per chunk, and the changed chunks back to back.
+//
+// A DeltaReader applies a base followed by its deltas in order, and can
+// decode the latest state after any of them.
+
+inline constexpr std::size_t kDefaultDeltaChunkSize = 4096;
+
+namespace detail {
+
+inline std::uint64_t mix64(std::uint64_t x) {
+  x ^= x >> 32;
+  x *= 0xd6e8feb86659fd93ull;
+  x ^= x >> 32;
+  x *= 0xd6e8feb86659fd93ull;
+  x ^= x >> 32;
+  return x;
+}
+
+// 64-bit chunk fingerprint. Not cryptographic: a collision would hide a
+// change, which is negligible for data that is not crafted against it.
+inline std::uint64_t fingerprint(const char* data, std::size_t size) {
+  constexpr std::uint64_t kMul = 0x9e3779b97f4a7c15ull;
+  std::uint64_t h = mix64(size * kMul);
+  std::size_t i = 0;
+  for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+    std::uint64_t w = 0;
+    std::memcpy(&w, data + i, sizeof(w));
+    h = (h ^ mix64(w)) * kMul;
+  }
+  if (i < size) {
+    std::uint64_t w = 0;
+    std::memcpy(&w, data + i, size - i);
+    h = (h ^ mix64(w)) * kMul;
+  }
+  return mix64(h);
+}
+
+inline std::size_t num_chunks(std::size_t size, std::size_t chunk_size) {
+  return (size + chunk_size - 1) / chunk_size;
+}
+
+// Handed to the root's io() in place of a serializer: every value it is
+// given becomes a field of its own.
+template <class Format>
+class DeltaFieldEncoder {
+ public:
+  template <class... Args>
+  DeltaFieldEncoder& operator()(const Args&... args) {
+    (encode(args), ...);
+    return *this;
+  }
+
+  std::vector<std::vector<char>>& fields() { return fields_; }
+
+ private:
+  template <class T>
+  void encode(const T& t) {
+    BasicBinaryOutputSerializer<VectorSink, Format> ser;
+    ser(t);
+    fields_.push_back(std::move(ser.get_result()));
+  }
+
+  std::vector<std::vector<char>> fields_;
+};
+
+template <class Format>
+class DeltaFieldDecoder {
+ public:
+  explicit DeltaFieldDecoder(const std::vector<std::vector<char>>& fields)
+      : fields_(fields) {}
+
+  template <class... Args>
+  DeltaFieldDecoder& operator()(Args&... args) {
+    (decode(args), ...);
+    return *this;
+  }
+
+  std::size_t num_decoded() const { return next_; }
+
+ private:
+  template <class T>
+  void decode(T& t) {
+    if (next_ >= fields_.size()) {
+      throw std::out_of_range("binary archive: missing delta field");
+    }
+    BasicBinaryInputSerializer<BufferSource, Format> ser(fields_[next_++]);
+    ser(t);
+  }
+
+  const std::vector<std::vector<char>>& fields_;
+  std::size_t next_{0};
+};
+
+// Splits |root| into its io() fields, the way OutputSerializer enters io().
+template <class S, class T>
+void visit_fields(S& fields, T& root) {
+  if constexpr (traits::HasMemberIo<S, T>::value) {
+    root.io(fields);
+  } else if constexpr (traits::HasNonMemberIo<S, T>::value) {
+    io(fields, root);
+  } else {
+    fields(root);
+  }
+}
+
+}  // namespace detail
+
+// Fields are encoded with |Format|; the snapshot framing uses the format of
+// the serializer it is written to.
+template <class Format = NativeFormat>
+class DeltaWriter {
+ public:
+  explicit DeltaWriter(std::size_t chunk_size = kDefaultDeltaChunkSize)
+      : chunk_size_(chunk_size) {
+    if (chunk_size_ == 0) {
+      throw std::invalid_argument("delta chunk size must be positive");
+    }
+  }
+
+  // Writes a snapshot of |root|: a full base the first time, after reset(),
+  // or when the number of fields changed; a delta otherwise.
+  template <class Sink, class F, class T>
+  void save(BasicBinaryOutputSerializer<Sink, F>& ser, const T& root) {
+    detail::DeltaFieldEncoder<Format> encoder;
+    detail::visit_fields(encoder, const_cast<T&>(root));
+    auto& fields = encoder.fields();
+    if (fields.size() != fingerprints_.size()) {
+      reset();
+    }
+    const bool base = fingerprints_.empty();
+    if (base) {
+      fingerprints_.resize(fields.size());
+      sequence_ = 0;
+    } else {
+      ++sequence_;
+    }
+
+    const std::uint64_t header[] = {sequence_, chunk_size_, fields.size()};
+    ser(header);
+    for (std::size_t f = 0; f < fields.size(); ++f) {
+      const auto& field = fields[f];
+      auto& fps = fingerprints_[f];
+      const auto n = detail::num_chunks(field.size(), chunk_size_);
+      std::vector<std::uint64_t> changed((n + 63) / 64);
+      std::vector<std::uint64_t> new_fps(n);
+      for (std::size_t c = 0; c < n; ++c) {
+        new_fps[c] = detail::fingerprint(field.data() + c * chunk_size_,
+                                         chunk_len(field.size(), c));
+        if (base || c >= fps.size() || fps[c] != new_fps[c]) {
+          changed[c / 64] |= std::uint64_t{1} << (c % 64);
+        }
+      }
+      ser(std::uint64_t{field.size()}, changed);
+      for (std::size_t c = 0; c < n; ++c) {
+        if (changed[c / 64] >> (c % 64) & 1) {
+          ser.save_binary(field.data() + c * chunk_size_,
+                          chunk_len(field.size(), c));
+        }
+      }
+      fps = std::move(new_fps);
+    }
+  }
+
+  // Makes the next save() a full base snapshot.
+  void reset() { fingerprints_.clear(); }
+
+  // Sequence number of the last snapshot written.
+  std::uint64_t sequence() const { return sequence_; }
+
+ private:
+  std::size_t chunk_len(std::size_t size, std::size_t c) const {
+    return std::min(chunk_size_, size - c * chunk_size_);
+  }
+
+  std::size_t chunk_size_;
+  std::uint64_t sequence_{0};
+  // Per field, the fingerprint of each chunk of its last encoding.
+  std::vector<std::vector<std::uint64_t>> fingerprints_;
+};
+
+// Rebuilds the field encodings from a base snapshot and the deltas after it.
+// Views loaded out of it (ArrayView, std::string_view, Lazy) point into
+// those encodings and are invalidated by the next apply(). If apply() throws,
+// start over from a base.
+template <class Format = NativeFormat>
+class DeltaReader {
+ public:
+  template <class Source, class F>
+  void apply(BasicBinaryInputSerializer<Source, F>& ser) {
+    std::uint64_t header[3];
+    ser(header);
+    const auto [sequence, chunk_size, num_fields] = header;
+    if (chunk_size == 0) {
+      throw std::out_of_range("binary archive: bad delta chunk size");
+    }
+    if (sequence == 0) {
+      ser.template expect_array<std::uint64_t>(num_fields);
+      fields_.assign(num_fields, {});
+      has_base_ = true;
+    } else if (!has_base_ || sequence != sequence_ + 1 ||
+               chunk_size != chunk_size_ || num_fields != fields_.size()) {
+      throw std::out_of_range("binary archive: delta out of sequence");
+    }
+    sequence_ = sequence;
+    chunk_size_ = chunk_size;
+
+    for (auto& field : fields_) {
+      std::uint64_t size = 0;
+      std::vector<std::uint64_t> changed;
+      ser(size, changed);
+      const auto n = detail::num_chunks(size, chunk_size_);
+      if (changed.size() != (n + 63) / 64) {
+        throw std::out_of_range("binary archive: bad delta change map");
+      }
+      const std::size_t old_size = field.size();
+      ser.template expect_array<char>(size > old_size ? size - old_size : 0);
+      field.resize(size);
+      for (std::size_t c = 0; c < n; ++c) {
+        const auto begin = c * chunk_size_;
+        const auto len = std::min<std::size_t>(chunk_size_, size - begin);
+        if (changed[c / 64] >> (c % 64) & 1) {
+          ser.load_binary(field.data() + begin, len);
+        } else if (begin + len > old_size) {
+          throw std::out_of_range("binary archive: delta misses new bytes");
+        }
+      }
+    }
+  }
+
+  // Decodes the latest snapshot into |root|, which must have the same fields
+  // as the object that was saved.
+  template <class T>
+  void load(T& root) const {
+    if (!has_base_) {
+      throw std::out_of_range("binary archive: no base snapshot");
+    }
+    detail::DeltaFieldDecoder<Format> decoder(fields_);
+    detail::visit_fields(decoder, root);
+    if (decoder.num_decoded() != fields_.size()) {
+      throw std::out_of_range("binary archive: extra delta fields");
+    }
+  }
+
+  std::uint64_t sequence() const { return sequence_; }
+
+ private:
+  bool has_base_{false};
+  std::uint64_t sequence_{0};
+  std::uint64_t chunk_size_{0};
+  // The current encoding of each field, an embedded archive.
+  std::vector<std::vector<char>> fields_;
+};
+
+}  // namespace taichi
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <limits.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include "binary.h"
+
+namespace taichi {
+
+// Scatter-gather output: small fields are packed into a buffer as usual, but
+// large contiguous payloads (vectors, arrays and strings of the caller) are
+// only referenced, so that a multi-GB tensor is never copied before it goes
+// out with writev() or sendmsg(). The archive is a list of iovecs over the
+// buffer and those payloads.
+//
+// Everything saved as a large payload must stay alive and unchanged until
+// the archive has been written out; in particular, do not save temporaries.
+
+inline constexpr std::size_t kDefaultGatherThreshold = 1 << 16;
+
+// What a GatherSink produces. Move-only: the iovecs point into its own
+// buffer (which a move hands over intact) and into the referenced payloads.
+class GatherArchive {
+ public:
+  GatherArchive() = default;
+  GatherArchive(const GatherArchive&) = delete;
+  GatherArchive& operator=(const GatherArchive&) = delete;
+  GatherArchive(GatherArchive&&) = default;
+  GatherArchive& operator=(GatherArchive&&) = default;
+
+  std::size_t size() const { return size_; }
+
+  const std::vector<iovec>& iovecs() const { return iovecs_; }
+
+  // Writes the whole archive to |fd|, IOV_MAX entries per writev() call.
+  void write_to(int fd) const {
+    std::vector<iovec> pending(iovecs_);
+    auto* first = pending.data();
+    auto* last = first + pending.size();
+    while (first != last) {
+      const int count = static_cast<int>(std::min<std::size_t>(
+          last - first, static_cast<std::size_t>(IOV_MAX)));
+      auto n = ::writev(fd, first, count);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::system_error(errno, std::generic_category(), "writev");
+      }
+      // Skip what went out; a partial write leaves |first| mid-entry.
+      while (first != last && static_cast<std::size_t>(n) >= first->iov_len) {
+        n -= first->iov_len;
+        ++first;
+      }
+      if (n > 0) {
+        first->iov_base = static_cast<char*>(first->iov_base) + n;
+        first->iov_len -= n;
+      }
+    }
+  }
+
+  // Copies the archive into one contiguous buffer.
+  std::vector<char> flatten() const {
+    std::vector<char> out(size_);
+    auto* dst = out.data();
+    for (const auto& v : iovecs_) {
+      std::memcpy(dst, v.iov_base, v.iov_len);
+      dst += v.iov_len;
+    }
+    return out;
+  }
+
+ private:
+  friend class GatherSink;
+
+  std::vector<char> buffer_;
+  std::vector<iovec> iovecs_;
+  std::size_t size_{0};
+};
+
+// Payloads of at least |threshold| bytes are referenced rather than copied.
+class GatherSink {
+ public:
+  explicit GatherSink(std::size_t threshold = kDefaultGatherThreshold)
+      : threshold_(threshold) {}
+
+  void write(const void* data, std::size_t size) {
+    if (size > 0) {
+      std::memcpy(claim(size), data, size);
+    }
+  }
+
+  void write_zeros(std::size_t size) {
+    if (size > 0) {
+      std::memset(claim(size), 0, size);
+    }
+  }
+
+  // Empty claims add no segment.
+  char* claim(std::size_t size) {
+    auto& buffer = archive_.buffer_;
+    const auto offset = buffer.size();
+    if (size == 0) {
+      return buffer.data() + offset;
+    }
+    buffer.resize(offset + size);
+    if (segments_.empty() || segments_.back().payload != nullptr) {
+      segments_.push_back({nullptr, offset, 0});
+    }
+    segments_.back().size += size;
+    return buffer.data() + offset;
+  }
+
+  // Bytes owned by the caller that outlive the archive.
+  void reference(const void* data, std::size_t size) {
+    if (size == 0) {
+      return;
+    }
+    if (size < threshold_) {
+      write(data, size);
+      return;
+    }
+    segments_.push_back({static_cast<const char*>(data), 0, size});
+  }
+
+  // The buffer has stopped moving, so the iovecs can be laid out.
+  void finish(std::size_t total) {
+    auto& buffer = archive_.buffer_;
+    detail::store_header(buffer.data(), total);
+    archive_.iovecs_.clear();
+    archive_.iovecs_.reserve(segments_.size());
+    for (const auto& s : segments_) {
+      const char* base =
+          s.payload != nullptr ? s.payload : buffer.data() + s.offset;
+      archive_.iovecs_.push_back({const_cast<char*>(base), s.size});
+    }
+    archive_.size_ = total;
+  }
+
+  // Callers may move it out.
+  GatherArchive& result() { return archive_; }
+
+ private:
+  // A run of buffered bytes (|payload| null, starting at |offset|) or a
+  // referenced payload.
+  struct Segment {
+    const char* payload;
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  std::size_t threshold_;
+  std::vector<Segment> segments_;
+  GatherArchive archive_;
+};
+
+using GatherBinaryOutputSerializer = BasicBinaryOutputSerializer<GatherSink>;
+
+}  // namespace taichi
@@ -0,0 +1,500 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "binary.h"
+
+namespace taichi {
+
+// Read-only memory mapping of a whole file. Pages are only faulted in when a
+// reader touches them, so decoding a few fields of a large archive only reads
+// those fields from disk.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::system_error(errno, std::generic_category(), "open");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0) {
+      const int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "fstat");
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        const int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "mmap");
+      }
+      // Lazy readers jump around; don't bother reading ahead.
+      ::madvise(addr, size_, MADV_RANDOM);
+      data_ = static_cast<const char*>(addr);
+    }
+    ::close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  const char* data_{nullptr};
+  std::size_t size_{0};
+};
+
+// A field that is decoded on first access. Loaded from an in-memory binary
+// archive, it only records where its encoding lives; get() decodes it then.
+// Loaded from any other binary source, it is decoded right away.
+// The encoding is an embedded archive of its own (header included), aligned
+// to 16 bytes, so it can be skipped without being parsed.
+//
+// The archive buffer must outlive any Lazy loaded from it that has not been
+// decoded yet. Decoding through a const Lazy is not thread-safe.
+template <typename T>
+class Lazy {
+ public:
+  using Decoder = void (*)(const char*, std::size_t, T&);
+
+  Lazy() = default;
+  Lazy(T value) : value_(std::move(value)) {}
+
+  Lazy& operator=(T value) {
+    value_ = std::move(value);
+    data_ = nullptr;
+    size_ = 0;
+    return *this;
+  }
+
+  bool decoded() const { return value_.has_value(); }
+
+  const T& get() const {
+    if (!value_) {
+      decode();
+    }
+    return *value_;
+  }
+
+  // Mutable access: the encoded bytes no longer describe the value after this.
+  T& get() {
+    if (!value_) {
+      decode();
+    }
+    data_ = nullptr;
+    size_ = 0;
+    return *value_;
+  }
+
+  const T& operator*() const { return get(); }
+  const T* operator->() const { return &get(); }
+
+  // The encoded embedded archive, if this was loaded and not modified since.
+  const char* encoded_data() const { return data_; }
+  std::size_t encoded_size() const { return size_; }
+
+  void set_encoded(const char* data, std::size_t size, Decoder decoder) {
+    value_.reset();
+    data_ = data;
+    size_ = size;
+    decoder_ = decoder;
+  }
+
+ private:
+  void decode() const {
+    value_.emplace();
+    if (data_ != nullptr) {
+      decoder_(data_, size_, *value_);
+    }
+  }
+
+  mutable std::optional<T> value_;
+  const char* data_{nullptr};
+  std::size_t size_{0};
+  Decoder decoder_{nullptr};
+};
+
+namespace detail {
+
+// Embedded archives start 16-byte aligned so that offsets inside them have
+// the same alignment as in the enclosing archive.
+inline constexpr std::size_t kEmbeddedArchiveAlignment = 16;
+
+template <class Format, class T>
+void decode_embedded(const char* data, std::size_t size, T& t) {
+  BasicBinaryInputSerializer<BufferSource, Format> ser(data, size);
+  ser(t);
+}
+
+}  // namespace detail
+
+template <class Sink, class Format, class T>
+void save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+          const Lazy<T>& lazy) {
+  ser.align(detail::kEmbeddedArchiveAlignment);
+  if (lazy.encoded_data() != nullptr) {
+    // Untouched since it was loaded: pass the bytes through undecoded.
+    ser.save_binary(lazy.encoded_data(), lazy.encoded_size());
+    return;
+  }
+  // The header of the embedded archive is its size, which is counted first
+  // so that the value can be written straight into |ser|.
+  char header[sizeof(std::uint64_t)];
+  detail::store_header(header, serialized_size<Format>(lazy.get()));
+  ser.save_binary(header, sizeof(header));
+  ser(lazy.get());
+}
+
+template <class Source, class Format, class T>
+void load(BasicBinaryInputSerializer<Source, Format>& ser, Lazy<T>& lazy) {
+  ser.align(detail::kEmbeddedArchiveAlignment);
+  if constexpr (detail::HasView<Source>::value) {
+    const char* data = ser.view_binary(sizeof(std::uint64_t));
+    const std::size_t size = detail::load_header(data);
+    if (size < sizeof(std::uint64_t)) {
+      throw std::out_of_range("binary archive: bad embedded archive");
+    }
+    ser.view_binary(size - sizeof(std::uint64_t));
+    lazy.set_encoded(data, size, &detail::decode_embedded<Format, T>);
+  } else {
+    // The bytes do not stay put, so decode them now. The embedded archive
+    // starts aligned, so it decodes in place like any other field.
+    char header[sizeof(std::uint64_t)];
+    ser.load_binary(header, sizeof(header));
+    const std::size_t size = detail::load_header(header);
+    if (size < sizeof(header)) {
+      throw std::out_of_range("binary archive: bad embedded archive");
+    }
+    const std::size_t begin = ser.position();
+    T value;
+    ser(value);
+    if (ser.position() - begin != size - sizeof(header)) {
+      throw std::out_of_range("binary archive: bad embedded archive");
+    }
+    lazy = std::move(value);
+  }
+}
+
+// Other serializers see straight through Lazy.
+template <typename S, typename T>
+void save(S& ser, const Lazy<T>& lazy) {
+  ser(lazy.get());
+}
+
+template <typename S, typename T>
+void load(S& ser, Lazy<T>& lazy) {
+  T value;
+  ser(value);
+  lazy = std::move(value);
+}
+
+// Saves |args| as top-level fields followed by an offset table, so that a
+// LazyArchive can decode any one of them without walking the others. This
+// must be the last thing written to |ser|.
+//
+// Offset table: 8-byte aligned, one 8-byte offset per field, then the field
+// count in the last 8 bytes of the archive; all little-endian.
+template <class Sink, class Format, class... Args>
+void save_indexed(BasicBinaryOutputSerializer<Sink, Format>& ser,
+                  const Args&... args) {
+  // offsets[i] is where field i starts; the extra last entry is where the
+  // last field ends. Braced initializers are evaluated left to right.
+  std::uint64_t offsets[] = {std::uint64_t{ser.size()},
+                             (ser(args), std::uint64_t{ser.size()})...};
+  for (auto& offset : offsets) {
+    offset = detail::to_byte_order<ByteOrder::kLittle>(offset);
+  }
+  ser.align(alignof(std::uint64_t));
+  ser.save_binary(offsets, sizeof(std::uint64_t) * sizeof...(args));
+  const auto count =
+      detail::to_byte_order<ByteOrder::kLittle>(std::uint64_t{sizeof...(args)});
+  ser.save_binary(&count, sizeof(count));
+}
+
+// Random access to the top-level fields of an archive written by
+// save_indexed(). Nothing is decoded until a field is asked for.
+template <class Format = NativeFormat>
+class LazyArchive {
+ public:
+  LazyArchive(const char* data, std::size_t size) : data_(data) {
+    if (size < sizeof(std::uint64_t)) {
+      throw std::out_of_range("binary archive: missing header");
+    }
+    const std::size_t archive_size = detail::load_header(data);
+    size_ = archive_size == 0 ? size : archive_size;
+    if (size_ > size || size_ < 2 * sizeof(std::uint64_t)) {
+      throw std::out_of_range("binary archive: bad header");
+    }
+    const auto count =
+        detail::load_le<std::uint64_t>(data_ + size_ - sizeof(std::uint64_t));
+    if (count > (size_ - 2 * sizeof(count)) / sizeof(count)) {
+      throw std::out_of_range("binary archive: bad offset table");
+    }
+    num_fields_ = count;
+    table_ = data_ + size_ - sizeof(count) * (count + 1);
+  }
+
+  explicit LazyArchive(const MappedFile& file)
+      : LazyArchive(file.data(), file.size()) {}
+
+  std::size_t num_fields() const { return num_fields_; }
+
+  // Byte offset of field |i| inside the archive.
+  std::size_t offset(std::size_t i) const {
+    if (i >= num_fields_) {
+      throw std::out_of_range("binary archive: no such field");
+    }
+    return detail::load_le<std::uint64_t>(table_ + sizeof(std::uint64_t) * i);
+  }
+
+  template <class T>
+  void load(std::size_t i, T& t) const {
+    BasicBinaryInputSerializer<BufferSource, Format> ser(data_, size_);
+    ser.seek(offset(i));
+    ser(t);
+  }
+
+  template <class T>
+  T get(std::size_t i) const {
+    T t;
+    load(i, t);
+    return t;
+  }
+
+ private:
+  const char* data_{nullptr};
+  std::size_t size_{0};
+  std::size_t num_fields_{0};
+  const char* table_{nullptr};
+};
+
+// A vector whose elements can be decoded one at a time. Saved from a
+// std::vector, it is written as an embedded archive (16-byte aligned) with
+// the elements back to back followed by the same offset table save_indexed()
+// writes, so at(i) seeks straight to element i. Loaded from an in-memory
+// binary archive, it only records where that embedded archive lives.
+//
+// Like Lazy, a loaded IndexedView must not outlive the archive buffer, and
+// one that is saved again passes its bytes through undecoded. Loaded from a
+// binary source that cannot hand out views, it keeps its own copy of the
+// embedded archive; loaded by any other serializer, its own vector.
+template <typename T>
+class IndexedView {
+ public:
+  // Decodes |count| consecutive elements, the first of which starts |offset|
+  // bytes into the embedded archive at |data|.
+  using Decoder = void (*)(const char* data, std::size_t size,
+                           std::size_t offset, T* out, std::size_t count);
+
+  IndexedView() = default;
+  explicit IndexedView(const std::vector<T>& vec)
+      : vec_(&vec), size_(vec.size()) {}
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T at(std::size_t i) const {
+    if (i >= size_) {
+      throw std::out_of_range("binary archive: index out of range");
+    }
+    if (vec_ != nullptr) {
+      return (*vec_)[i];
+    }
+    T t;
+    decoder_(data_, encoded_size_, offset(i), &t, 1);
+    return t;
+  }
+
+  // Elements [i, j).
+  std::vector<T> range(std::size_t i, std::size_t j) const {
+    if (i > j || j > size_) {
+      throw std::out_of_range("binary archive: index out of range");
+    }
+    if (vec_ != nullptr) {
+      return std::vector<T>(vec_->begin() + i, vec_->begin() + j);
+    }
+    std::vector<T> out(j - i);
+    if (i < j) {
+      decoder_(data_, encoded_size_, offset(i), out.data(), out.size());
+    }
+    return out;
+  }
+
+  // The vector this was constructed from, if any.
+  const std::vector<T>* source() const { return vec_; }
+
+  // The encoded embedded archive, if this was loaded.
+  const char* encoded_data() const { return data_; }
+  std::size_t encoded_size() const { return encoded_size_; }
+
+  // |owner|, if given, keeps |data| alive.
+  void set_encoded(const char* data, std::size_t size, std::size_t count,
+                   Decoder decoder, std::shared_ptr<const void> owner = {}) {
+    vec_ = nullptr;
+    data_ = data;
+    encoded_size_ = size;
+    size_ = count;
+    decoder_ = decoder;
+    owner_ = std::move(owner);
+  }
+
+  void set_source(std::shared_ptr<const std::vector<T>> vec) {
+    vec_ = vec.get();
+    size_ = vec->size();
+    data_ = nullptr;
+    encoded_size_ = 0;
+    owner_ = std::move(vec);
+  }
+
+ private:
+  std::size_t offset(std::size_t i) const {
+    // The table sits right before the element count at the very end.
+    const char* table =
+        data_ + encoded_size_ - sizeof(std::uint64_t) * (size_ + 1);
+    const auto offset =
+        detail::load_le<std::uint64_t>(table + sizeof(std::uint64_t) * i);
+    if (offset < sizeof(offset) || offset > encoded_size_) {
+      throw std::out_of_range("binary archive: bad offset table");
+    }
+    return offset;
+  }
+
+  const std::vector<T>* vec_{nullptr};
+  std::size_t size_{0};
+  const char* data_{nullptr};
+  std::size_t encoded_size_{0};
+  Decoder decoder_{nullptr};
+  std::shared_ptr<const void> owner_;
+};
+
+namespace detail {
+
+template <class Format, class T>
+void decode_embedded_range(const char* data, std::size_t size,
+                           std::size_t offset, T* out, std::size_t count) {
+  BasicBinaryInputSerializer<BufferSource, Format> ser(data, size);
+  ser.seek(offset);
+  for (std::size_t i = 0; i < count; ++i) {
+    ser(out[i]);
+  }
+}
+
+}  // namespace detail
+
+template <class Sink, class Format, class T>
+void save(BasicBinaryOutputSerializer<Sink, Format>& ser,
+          const IndexedView<T>& view) {
+  ser.align(detail::kEmbeddedArchiveAlignment);
+  if (view.encoded_data() != nullptr) {
+    ser.save_binary(view.encoded_data(), view.encoded_size());
+    return;
+  }
+  const auto& vec = *view.source();
+  // Size the elements first so that the header can be written up front; the
+  // embedded archive starts aligned, so padding comes out the same.
+  BasicBinaryOutputSerializer<SizeCountingSink, Format> counter;
+  for (const auto& t : vec) {
+    counter(t);
+  }
+  const auto table_begin = (counter.size() + alignof(std::uint64_t) - 1) /
+                           alignof(std::uint64_t) * alignof(std::uint64_t);
+  const std::uint64_t count = vec.size();
+  const std::size_t size = table_begin + sizeof(count) * (count + 1);
+
+  const std::size_t start = ser.size();
+  char header[sizeof(std::uint64_t)];
+  detail::store_header(header, size);
+  ser.save_binary(header, sizeof(header));
+  std::vector<std::uint64_t> offsets(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    offsets[i] = detail::to_byte_order<ByteOrder::kLittle>(
+        std::uint64_t{ser.size() - start});
+    ser(vec[i]);
+  }
+  ser.align(alignof(std::uint64_t));
+  ser.save_binary(offsets.data(), sizeof(count) * count);
+  const auto le_count = detail::to_byte_order<ByteOrder::kLittle>(count);
+  ser.save_binary(&le_count, sizeof(le_count));
+  assert(ser.size() - start == size);
+}
+
+template <class Source, class Format, class T>
+void load(BasicBinaryInputSerializer<Source, Format>& ser,
+          IndexedView<T>& view) {
+  ser.align(detail::kEmbeddedArchiveAlignment);
+  const char* data = nullptr;
+  std::size_t size = 0;
+  std::shared_ptr<std::vector<char>> copy;
+  if constexpr (detail::HasView<Source>::value) {
+    data = ser.view_binary(sizeof(std::uint64_t));
+    size = detail::load_header(data);
+    if (size < sizeof(std::uint64_t)) {
+      throw std::out_of_range("binary archive: bad embedded archive");
+    }
+    ser.view_binary(size - sizeof(std::uint64_t));
+  } else {
+    char header[sizeof(std::uint64_t)];
+    ser.load_binary(header, sizeof(header));
+    size = detail::load_header(header);
+    if (size < sizeof(header)) {
+      throw std::out_of_range("binary archive: bad embedded archive");
+    }
+    ser.template expect_array<char>(size - sizeof(header));
+    // operator new aligns the copy at least as well as the original.
+    copy = std::make_shared<std::vector<char>>(size);
+    std::memcpy(copy->data(), header, sizeof(header));
+    ser.load_binary(copy->data() + sizeof(header), size - sizeof(header));
+    data = copy->data();
+  }
+  // Checks that the offset table fits; offsets are checked as they are used.
+  const LazyArchive<Format> archive(data, size);
+  view.set_encoded(data, size, archive.num_fields(),
+                   &detail::decode_embedded_range<Format, T>, std::move(copy));
+}
+
+// Other serializers see an IndexedView as a plain vector.
+template <typename S, typename T>
+void save(S& ser, const IndexedView<T>& view) {
+  ser(view.size());
+  for (std::size_t i = 0; i < view.size(); ++i) {
+    ser(view.at(i));
+  }
+}
+
+template <typename S, typename T>
+void load(S& ser, IndexedView<T>& view) {
+  std::size_t size = 0;
+  ser(size);
+  auto vec = std::make_shared<std::vector<T>>(size);
+  for (auto& t : *vec) {
+    ser(t);
+  }
+  view.set_source(std::move(vec));
+}
+
+}  // namespace taichi
@@ -2,7 +2,7 @@
 #include <string>
 #include <vector>
 
-// #include "binary.h"
+#include "binary.h"
 #include "stl.h"
 #include "text.h"
 // #include "traits.h"
@@ -37,6 +37,19 @@ int main() {
   using Checked = int;
   ser(f);
   std::cout << ser.get_result() << std::endl;
+
+  BinaryOutputSerializer bout;
+  std::vector<float> samples{1.0f, 2.0f, 3.0f};
+  bout(f, samples);
+  const auto &archive = bout.get_result();
+
+  BinaryInputSerializer bin(archive);
+  Foo g;
+  ArrayView<float> samples_view;
+  bin(g, samples_view);
+  TextOutputSerializer gser;
+  gser(g);
+  std::cout << gser.get_result() << samples_view.size() << std::endl;
   // f.io(ser);
   // std::cout << "HasMemberIo=" << traits::HasMemberIo<SER, Checked>::value
   //           << std::endl
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "binary.h"
+
+namespace taichi {
+namespace detail {
+
+// Runs fn(0), ..., fn(num_tasks - 1) on up to |num_threads| threads, which
+// pull task indices from a shared counter. The first exception thrown by any
+// task is rethrown once all threads have joined.
+template <class Fn>
+void parallel_for(std::size_t num_tasks, std::size_t num_threads, Fn&& fn) {
+  num_threads = std::max<std::size_t>(1, std::min(num_threads, num_tasks));
+  if (num_threads == 1) {
+    for (std::size_t i = 0; i < num_tasks; ++i) {
+      fn(i);
+    }
+    return;
+  }
+  std::atomic<std::size_t> next{0};
+  std::exception_ptr error;
+  std::atomic<bool> failed{false};
+  auto worker = [&]() {
+    for (auto i = next++; i < num_tasks && !failed; i = next++) {
+      try {
+        fn(i);
+      } catch (...) {
+        if (!failed.exchange(true)) {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (std::size_t t = 1; t < num_threads; ++t) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& t : threads) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+inline std::size_t default_num_threads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Enough chunks per thread to even out uneven element sizes.
+inline constexpr std::size_t kChunksPerThread = 4;
+
+inline constexpr std::size_t kChunkAlignment = 16;
+
+}  // namespace detail
+
+// Saves |vec| split into chunks that are serialized concurrently, each into
+// its own buffer, and then stitched together behind a chunk-offset index so
+// that load_parallel() can decode the chunks concurrently as well.
+//
+// Layout (16-byte aligned): element count, elements per chunk, chunk count,
+// then one offset per chunk relative to the first chunk, all little-endian
+// 8-byte words whatever the format's byte order. Each chunk is an
+// embedded archive (16-byte aligned, header = its size) holding its elements
+// back to back.
+template <class Sink, class Format, class T>
+void save_parallel(BasicBinaryOutputSerializer<Sink, Format>& ser,
+                   const std::vector<T>& vec,
+                   std::size_t num_threads = detail::default_num_threads(),
+                   std::size_t chunk_len = 0) {
+  const std::uint64_t count = vec.size();
+  if (chunk_len == 0) {
+    chunk_len = count / (num_threads * detail::kChunksPerThread) + 1;
+  }
+  const std::uint64_t num_chunks = (count + chunk_len - 1) / chunk_len;
+
+  std::vector<std::vector<char>> chunks(num_chunks);
+  detail::parallel_for(num_chunks, num_threads, [&](std::size_t c) {
+    BasicBinaryOutputSerializer<VectorSink, Format> chunk_ser;
+    const auto end = std::min<std::size_t>(count, (c + 1) * chunk_len);
+    for (auto i = c * chunk_len; i < end; ++i) {
+      chunk_ser(vec[i]);
+    }
+    chunks[c] = std::move(chunk_ser.get_result());
+  });
+
+  std::vector<std::uint64_t> offsets(num_chunks);
+  std::uint64_t offset = 0;
+  for (std::size_t c = 0; c < num_chunks; ++c) {
+    offsets[c] = detail::to_byte_order<ByteOrder::kLittle>(offset);
+    offset += chunks[c].size();
+    offset = (offset + detail::kChunkAlignment - 1) /
+             detail::kChunkAlignment * detail::kChunkAlignment;
+  }
+
+  const std::uint64_t meta[] = {
+      detail::to_byte_order<ByteOrder::kLittle>(count),
+      detail::to_byte_order<ByteOrder::kLittle>(std::uint64_t{chunk_len}),
+      detail::to_byte_order<ByteOrder::kLittle>(num_chunks)};
+  ser.align(detail::kChunkAlignment);
+  ser.save_binary(meta, sizeof(meta));
+  if (num_chunks == 0) {
+    return;
+  }
+  ser.save_binary(offsets.data(), offsets.size() * sizeof(std::uint64_t));
+  for (const auto& chunk : chunks) {
+    ser.align(detail::kChunkAlignment);
+    ser.save_binary(chunk.data(), chunk.size());
+  }
+}
+
+// Decodes what save_parallel() wrote, one chunk per task. Needs an in-memory
+// source, and T must be default-constructible.
+template <class Format, class T>
+void load_parallel(BasicBinaryInputSerializer<BufferSource, Format>& ser,
+                   std::vector<T>& vec,
+                   std::size_t num_threads = detail::default_num_threads()) {
+  ser.align(detail::kChunkAlignment);
+  std::uint64_t meta[3];
+  ser.load_binary(meta, sizeof(meta));
+  for (auto& m : meta) {
+    m = detail::to_byte_order<ByteOrder::kLittle>(m);
+  }
+  const auto count = meta[0];
+  const auto chunk_len = meta[1];
+  const auto num_chunks = meta[2];
+  if (chunk_len == 0 || num_chunks != (count + chunk_len - 1) / chunk_len) {
+    throw std::out_of_range("binary archive: bad chunk index");
+  }
+  if (num_chunks == 0) {
+    vec.clear();
+    return;
+  }
+  ser.template expect_array<std::uint64_t>(num_chunks);
+  std::vector<std::uint64_t> offsets(num_chunks);
+  ser.load_binary(offsets.data(), num_chunks * sizeof(std::uint64_t));
+  for (auto& offset : offsets) {
+    offset = detail::to_byte_order<ByteOrder::kLittle>(offset);
+  }
+
+  // Locate every chunk up front; the last one tells where the block ends.
+  ser.align(detail::kChunkAlignment);
+  const char* base = ser.view_binary(0);
+  const auto available = ser.remaining();
+  std::vector<std::size_t> sizes(num_chunks);
+  for (std::size_t c = 0; c < num_chunks; ++c) {
+    if (offsets[c] % detail::kChunkAlignment != 0 ||
+        available < sizeof(std::size_t) ||
+        offsets[c] > available - sizeof(std::size_t)) {
+      throw std::out_of_range("binary archive: bad chunk offset");
+    }
+    sizes[c] = detail::load_header(base + offsets[c]);
+    if (sizes[c] > available - offsets[c]) {
+      throw std::out_of_range("binary archive: bad chunk size");
+    }
+  }
+  ser.view_binary(offsets.back() + sizes.back());
+
+  vec.resize(count);
+  detail::parallel_for(num_chunks, num_threads, [&](std::size_t c) {
+    BasicBinaryInputSerializer<BufferSource, Format> chunk_ser(
+        base + offsets[c], sizes[c]);
+    const auto end = std::min<std::size_t>(count, (c + 1) * chunk_len);
+    for (auto i = c * chunk_len; i < end; ++i) {
+      chunk_ser(vec[i]);
+    }
+  });
+}
+
+}  // namespace taichi
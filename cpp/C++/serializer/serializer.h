@@ -1,5 +1,6 @@
 #pragma once
 
+#include <tuple>
 #include <type_traits>
 
 #include "traits.h"
@@ -36,6 +37,23 @@ class OutputSerializer : public detail::OutputSerializerBase {
     return *self_;
   }
 
+ protected:
+  // Called around every io(); serializers that need to delimit composite
+  // values (e.g. JSON) hide these.
+  void enter_io() {}
+  void leave_io() {}
+
+  // Runs |val|'s io(). Serializers with a faster encoding for some types hide
+  // this and fall back to it for the rest.
+  template <typename T>
+  void invoke_io(T &val) {
+    if constexpr (traits::HasMemberIo<SerializerType, T>::value) {
+      val.io(*self_);
+    } else {
+      io(*self_, val);
+    }
+  }
+
  private:
   template <class T>
   inline void process(T &&head) {
@@ -52,14 +70,18 @@ class OutputSerializer : public detail::OutputSerializerBase {
             traits::EnableIf<traits::HasMemberIo<SerializerType, T>::value> =
                 traits::kSfinae>
   inline void process_impl(const T &val) {
-    const_cast<T &>(val).io(*self_);
+    self_->enter_io();
+    self_->invoke_io(const_cast<T &>(val));
+    self_->leave_io();
   }
 
   template <typename T,
             traits::EnableIf<traits::HasNonMemberIo<SerializerType, T>::value> =
                 traits::kSfinae>
   inline void process_impl(const T &val) {
-    io(*self_, const_cast<T &>(val));
+    self_->enter_io();
+    self_->invoke_io(const_cast<T &>(val));
+    self_->leave_io();
   }
 
   template <typename T, traits::EnableIf<traits::HasNonMemberSave<
@@ -71,4 +93,70 @@ class OutputSerializer : public detail::OutputSerializerBase {
   SerializerType *const self_;
 };
 
+template <class SerializerType>
+class InputSerializer : public detail::InputSerializerBase {
+ public:
+  explicit InputSerializer(SerializerType *derived) : self_(derived) {}
+
+  template <class... Args>
+  inline SerializerType &operator()(Args &&... args) {
+    self_->process(std::forward<Args>(args)...);
+    return *self_;
+  }
+
+ protected:
+  // See OutputSerializer::invoke_io().
+  template <typename T>
+  void invoke_io(T &val) {
+    if constexpr (traits::HasMemberIo<SerializerType, T>::value) {
+      val.io(*self_);
+    } else {
+      io(*self_, val);
+    }
+  }
+
+ private:
+  template <class T>
+  inline void process(T &&head) {
+    self_->process_impl(head);
+  }
+
+  template <class T, class... Args>
+  inline void process(T &&head, Args &&... tail) {
+    self_->process(std::forward<T>(head));
+    self_->process(std::forward<Args>(tail)...);
+  }
+
+  template <typename T,
+            traits::EnableIf<traits::HasMemberIo<SerializerType, T>::value> =
+                traits::kSfinae>
+  inline void process_impl(T &val) {
+    self_->invoke_io(val);
+  }
+
+  template <typename T,
+            traits::EnableIf<traits::HasNonMemberIo<SerializerType, T>::value> =
+                traits::kSfinae>
+  inline void process_impl(T &val) {
+    self_->invoke_io(val);
+  }
+
+  template <typename T, traits::EnableIf<traits::HasNonMemberLoad<
+                            SerializerType, T>::value> = traits::kSfinae>
+  inline void process_impl(T &val) {
+    load(*self_, val);
+  }
+
+  SerializerType *const self_;
+};
+
 }  // namespace taichi
+
+// Declares io() over the given fields and also lists them, as a tuple of
+// references, for the binary serializers' fixed-layout path.
+#define TI_IO_FIELDS(...)                                     \
+  template <class S>                                          \
+  void io(S &ser) {                                           \
+    ser(__VA_ARGS__);                                         \
+  }                                                           \
+  auto ti_io_fields() const { return std::tie(__VA_ARGS__); }
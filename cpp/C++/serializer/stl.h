@@ -1,22 +1,209 @@
 #pragma once
 
-// #include <optional>
+#include <array>
+#include <cstddef>
+#include <map>
+#include <optional>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace taichi {
-template <typename S, typename T>
-void save(S& ser, const std::vector<T>& vec) {
+template <typename S, typename T, typename A>
+void save(S& ser, const std::vector<T, A>& vec) {
   ser(vec.size());
   for (const auto& i : vec) {
     ser(i);
   }
 }
 
+// Fixed-size arrays carry no length prefix.
+template <typename S, typename T, std::size_t N>
+void save(S& ser, const std::array<T, N>& arr) {
+  for (const auto& i : arr) {
+    ser(i);
+  }
+}
+
+template <typename S, typename T, std::size_t N>
+void save(S& ser, const T (&arr)[N]) {
+  for (const auto& i : arr) {
+    ser(i);
+  }
+}
+
+// Strings are encoded like a std::vector of their characters.
+template <typename S, typename C, typename Tr, typename A>
+void save(S& ser, const std::basic_string<C, Tr, A>& str) {
+  ser(str.size());
+  for (const auto c : str) {
+    ser(c);
+  }
+}
+
+template <typename S, typename T, typename U>
+void save(S& ser, const std::pair<T, U>& p) {
+  ser(p.first, p.second);
+}
+
+namespace detail {
+
+template <typename S, typename M>
+void save_map(S& ser, const M& map) {
+  ser(map.size());
+  for (const auto& kv : map) {
+    ser(kv.first, kv.second);
+  }
+}
+
+}  // namespace detail
+
+template <typename S, typename K, typename V, typename C, typename A>
+void save(S& ser, const std::map<K, V, C, A>& map) {
+  detail::save_map(ser, map);
+}
+
+template <typename S, typename K, typename V, typename H, typename E,
+          typename A>
+void save(S& ser, const std::unordered_map<K, V, H, E, A>& map) {
+  detail::save_map(ser, map);
+}
+
 template <typename S, typename T>
-void save(S& ser, const std::string& str) {
-  std::vector<char> vs(str.begin(), str.end());
-  save(ser, vs);
+void save(S& ser, const std::optional<T>& opt) {
+  ser(opt.has_value());
+  if (opt) {
+    ser(*opt);
+  }
+}
+
+template <typename S, typename T, typename A>
+void load(S& ser, std::vector<T, A>& vec) {
+  std::size_t size = 0;
+  ser(size);
+  vec.resize(size);
+  for (auto& i : vec) {
+    ser(i);
+  }
+}
+
+// The elements of std::vector<bool> are proxies, which do not bind to bool&.
+template <typename S, typename A>
+void load(S& ser, std::vector<bool, A>& vec) {
+  std::size_t size = 0;
+  ser(size);
+  vec.resize(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    bool b = false;
+    ser(b);
+    vec[i] = b;
+  }
+}
+
+template <typename S, typename T, std::size_t N>
+void load(S& ser, std::array<T, N>& arr) {
+  for (auto& i : arr) {
+    ser(i);
+  }
+}
+
+template <typename S, typename T, std::size_t N>
+void load(S& ser, T (&arr)[N]) {
+  for (auto& i : arr) {
+    ser(i);
+  }
+}
+
+template <typename S, typename C, typename Tr, typename A>
+void load(S& ser, std::basic_string<C, Tr, A>& str) {
+  std::size_t size = 0;
+  ser(size);
+  str.resize(size);
+  for (auto& c : str) {
+    ser(c);
+  }
+}
+
+template <typename S, typename T, typename U>
+void load(S& ser, std::pair<T, U>& p) {
+  ser(p.first, p.second);
+}
+
+namespace detail {
+
+// Value-initializes a T that allocates from |alloc| if it is allocator-aware,
+// so that e.g. std::pmr::string temporaries share their container's arena.
+template <typename T, typename Alloc>
+T make_with_allocator(const Alloc& alloc) {
+  if constexpr (std::uses_allocator_v<T, Alloc>) {
+    return T(alloc);
+  } else {
+    return T{};
+  }
+}
+
+template <typename M, typename = void>
+struct HasReserve : std::false_type {};
+
+template <typename M>
+struct HasReserve<M, std::void_t<decltype(std::declval<M&>().reserve(
+                         std::size_t{}))>> : std::true_type {};
+
+// Clears |map| for |size| entries. Hash maps get all their buckets up front
+// instead of rehashing their way there.
+template <typename M>
+void prepare_map(M& map, std::size_t size) {
+  map.clear();
+  if constexpr (HasReserve<M>::value) {
+    map.reserve(size);
+  }
+}
+
+// Ordered maps are saved in key order, so inserting at the end is the right
+// hint and every insertion is amortized O(1).
+template <typename M, typename K, typename V>
+void insert_loaded(M& map, K&& key, V&& value) {
+  map.emplace_hint(map.end(), std::forward<K>(key), std::forward<V>(value));
+}
+
+template <typename S, typename M>
+void load_map(S& ser, M& map) {
+  std::size_t size = 0;
+  ser(size);
+  prepare_map(map, size);
+  const auto alloc = map.get_allocator();
+  for (std::size_t i = 0; i < size; ++i) {
+    auto key = make_with_allocator<typename M::key_type>(alloc);
+    auto value = make_with_allocator<typename M::mapped_type>(alloc);
+    ser(key, value);
+    insert_loaded(map, std::move(key), std::move(value));
+  }
+}
+
+}  // namespace detail
+
+template <typename S, typename K, typename V, typename C, typename A>
+void load(S& ser, std::map<K, V, C, A>& map) {
+  detail::load_map(ser, map);
+}
+
+template <typename S, typename K, typename V, typename H, typename E,
+          typename A>
+void load(S& ser, std::unordered_map<K, V, H, E, A>& map) {
+  detail::load_map(ser, map);
+}
+
+template <typename S, typename T>
+void load(S& ser, std::optional<T>& opt) {
+  bool has_value = false;
+  ser(has_value);
+  if (has_value) {
+    ser(opt.emplace());
+  } else {
+    opt.reset();
+  }
 }
 
-}  // namespace taichi
\ No newline at end of file
+}  // namespace taichi
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "binary.h"
+
+namespace taichi {
+
+// Streaming binary archives: the serializer only ever holds one chunk of the
+// archive, so peak memory no longer grows with the archive size. Streamed
+// archives leave the size header 0 since it cannot be patched after the fact.
+
+// Writers and readers are the raw byte endpoints behind a chunked stream:
+//   void Writer::write(const char* data, std::size_t size);  // all or throw
+//   std::size_t Reader::read(char* data, std::size_t size);  // 0 at EOF
+// A reader may also tell how many bytes it has left, if it knows:
+//   std::size_t Reader::available();  // or kUnknownAvailable
+
+inline constexpr std::size_t kUnknownAvailable =
+    std::numeric_limits<std::size_t>::max();
+
+namespace detail {
+
+template <class Reader, class = void>
+struct HasAvailable : std::false_type {};
+
+template <class Reader>
+struct HasAvailable<Reader,
+                    std::void_t<decltype(std::declval<Reader&>().available())>>
+    : std::true_type {};
+
+}  // namespace detail
+
+class FdWriter {
+ public:
+  explicit FdWriter(int fd) : fd_(fd) {}
+
+  void write(const char* data, std::size_t size) {
+    while (size > 0) {
+      const auto n = ::write(fd_, data, size);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::system_error(errno, std::generic_category(), "write");
+      }
+      data += n;
+      size -= n;
+    }
+  }
+
+ private:
+  int fd_;
+};
+
+class FdReader {
+ public:
+  explicit FdReader(int fd) : fd_(fd) {}
+
+  std::size_t read(char* data, std::size_t size) {
+    while (true) {
+      const auto n = ::read(fd_, data, size);
+      if (n >= 0) {
+        return n;
+      }
+      if (errno != EINTR) {
+        throw std::system_error(errno, std::generic_category(), "read");
+      }
+    }
+  }
+
+  // Known for regular files only.
+  std::size_t available() {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0 || !S_ISREG(st.st_mode)) {
+      return kUnknownAvailable;
+    }
+    const auto offset = ::lseek(fd_, 0, SEEK_CUR);
+    if (offset < 0) {
+      return kUnknownAvailable;
+    }
+    return offset < st.st_size ? st.st_size - offset : 0;
+  }
+
+ private:
+  int fd_;
+};
+
+class CallbackWriter {
+ public:
+  using Callback = std::function<void(const char*, std::size_t)>;
+
+  explicit CallbackWriter(Callback callback) : callback_(std::move(callback)) {}
+
+  void write(const char* data, std::size_t size) { callback_(data, size); }
+
+ private:
+  Callback callback_;
+};
+
+class CallbackReader {
+ public:
+  using Callback = std::function<std::size_t(char*, std::size_t)>;
+
+  explicit CallbackReader(Callback callback) : callback_(std::move(callback)) {}
+
+  std::size_t read(char* data, std::size_t size) {
+    return callback_(data, size);
+  }
+
+ private:
+  Callback callback_;
+};
+
+inline constexpr std::size_t kDefaultChunkSize = 1 << 16;
+
+// Buffers writes into a fixed-size chunk and hands full chunks to |Writer|.
+// Payloads larger than a chunk bypass the buffer. get_result() flushes.
+template <class Writer>
+class ChunkedSink {
+ public:
+  explicit ChunkedSink(Writer writer,
+                       std::size_t chunk_size = kDefaultChunkSize)
+      : writer_(std::move(writer)), chunk_(chunk_size) {}
+
+  void write(const void* data, std::size_t size) {
+    if (size == 0) {
+      return;
+    }
+    const auto* src = static_cast<const char*>(data);
+    if (size > chunk_.size() - used_) {
+      flush();
+      if (size >= chunk_.size()) {
+        writer_.write(src, size);
+        return;
+      }
+    }
+    std::memcpy(chunk_.data() + used_, src, size);
+    used_ += size;
+  }
+
+  void write_zeros(std::size_t size) {
+    while (size > 0) {
+      if (used_ == chunk_.size()) {
+        flush();
+      }
+      const auto n = std::min(size, chunk_.size() - used_);
+      std::memset(chunk_.data() + used_, 0, n);
+      used_ += n;
+      size -= n;
+    }
+  }
+
+  void flush() {
+    if (used_ > 0) {
+      writer_.write(chunk_.data(), used_);
+      used_ = 0;
+    }
+  }
+
+  void finish(std::size_t total) {
+    flush();
+    total_ = total;
+  }
+
+  std::size_t result() const { return total_; }
+
+ private:
+  Writer writer_;
+  std::vector<char> chunk_;
+  std::size_t used_{0};
+  std::size_t total_{0};
+};
+
+// Refills a fixed-size chunk from |Reader| as it is consumed. Reads larger
+// than a chunk go straight into the destination.
+template <class Reader>
+class ChunkedSource {
+ public:
+  explicit ChunkedSource(Reader reader,
+                         std::size_t chunk_size = kDefaultChunkSize)
+      : reader_(std::move(reader)), chunk_(chunk_size) {}
+
+  void read(void* data, std::size_t size) {
+    if (size == 0) {
+      return;
+    }
+    consumed_ += size;
+    auto* dst = static_cast<char*>(data);
+    const auto buffered = std::min(size, end_ - begin_);
+    std::memcpy(dst, chunk_.data() + begin_, buffered);
+    begin_ += buffered;
+    dst += buffered;
+    size -= buffered;
+    if (size == 0) {
+      return;
+    }
+    if (size >= chunk_.size()) {
+      read_fully(dst, size);
+      return;
+    }
+    refill(size);
+    std::memcpy(dst, chunk_.data(), size);
+    begin_ = size;
+  }
+
+  void skip(std::size_t size) {
+    consumed_ += size;
+    while (size > 0) {
+      if (begin_ == end_) {
+        refill(std::min(size, chunk_.size()));
+      }
+      const auto n = std::min(size, end_ - begin_);
+      begin_ += n;
+      size -= n;
+    }
+  }
+
+  // Throws if |size| more bytes are known not to exist, before the caller
+  // allocates for them: against the archive size from the header if there is
+  // one, else against what the reader says it has left (a regular file), else
+  // by reading ahead within the chunk. Past that, on a pipe say, a length
+  // cannot be checked without buffering the payload, so it is trusted and
+  // the read that follows throws if the stream falls short.
+  void expect(std::size_t size) {
+    if (archive_size_ != 0) {
+      if (size > archive_size_ - consumed_) {
+        throw std::out_of_range("binary archive: read past end");
+      }
+      return;
+    }
+    const auto buffered = end_ - begin_;
+    if (size <= buffered) {
+      return;
+    }
+    if constexpr (detail::HasAvailable<Reader>::value) {
+      const auto available = reader_.available();
+      if (available != kUnknownAvailable) {
+        if (size - buffered > available) {
+          throw std::out_of_range("binary archive: read past end");
+        }
+        return;
+      }
+    }
+    if (size > chunk_.size()) {
+      return;
+    }
+    std::memmove(chunk_.data(), chunk_.data() + begin_, buffered);
+    begin_ = 0;
+    end_ = buffered;
+    while (end_ < size) {
+      const auto n = reader_.read(chunk_.data() + end_, chunk_.size() - end_);
+      if (n == 0) {
+        throw std::out_of_range("binary archive: read past end");
+      }
+      end_ += n;
+    }
+  }
+
+  void set_archive_size(std::size_t total) {
+    if (total != 0 && total < consumed_) {
+      throw std::out_of_range("binary archive: bad header");
+    }
+    archive_size_ = total;
+  }
+
+ private:
+  // Refills the chunk with at least |min_size| bytes.
+  void refill(std::size_t min_size) {
+    begin_ = 0;
+    end_ = 0;
+    while (end_ < min_size) {
+      const auto n = reader_.read(chunk_.data() + end_, chunk_.size() - end_);
+      if (n == 0) {
+        throw std::out_of_range("binary archive: read past end");
+      }
+      end_ += n;
+    }
+  }
+
+  void read_fully(char* dst, std::size_t size) {
+    while (size > 0) {
+      const auto n = reader_.read(dst, size);
+      if (n == 0) {
+        throw std::out_of_range("binary archive: read past end");
+      }
+      dst += n;
+      size -= n;
+    }
+  }
+
+  Reader reader_;
+  std::vector<char> chunk_;
+  std::size_t begin_{0};
+  std::size_t end_{0};
+  std::size_t consumed_{0};
+  std::size_t archive_size_{0};  // 0 if unknown
+};
+
+using FdOutputSerializer = BasicBinaryOutputSerializer<ChunkedSink<FdWriter>>;
+using FdInputSerializer = BasicBinaryInputSerializer<ChunkedSource<FdReader>>;
+
+}  // namespace taichi
@@ -0,0 +1,949 @@
+// Round-trip tests for the sinks, sources and formats in this directory,
+// including empty and corrupt inputs. Run by ctest; configure with
+// -DTI_SERIALIZER_SANITIZE=ON to run them under ASan and UBSan.
+
+// The checks are asserts, kept on in every build type.
+#undef NDEBUG
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "arena.h"
+#include "binary.h"
+#include "checksum.h"
+#include "compress.h"
+#include "delta.h"
+#include "gather.h"
+#include "lazy.h"
+#include "parallel.h"
+#include "stl.h"
+#include "stream.h"
+#include "text.h"
+
+namespace {
+
+using namespace taichi;
+
+// Payloads empty, below and above the threshold, so every kind of segment
+// is written, and none of them empty.
+void test_gather() {
+  const std::vector<int> empty_ints;
+  const std::string empty_string;
+  const std::vector<int> small{1, 2, 3};
+  const std::vector<int> large(1000, 7);
+  const std::string text(100, 'x');
+
+  GatherBinaryOutputSerializer ser(GatherSink(64));
+  ser(empty_ints, empty_string, small, large, text, empty_ints);
+  const auto& archive = ser.get_result();
+  for (const auto& v : archive.iovecs()) {
+    assert(v.iov_len > 0);
+  }
+
+  const auto flat = archive.flatten();
+  assert(flat.size() == archive.size());
+  assert(flat == serialize(empty_ints, empty_string, small, large, text,
+                           empty_ints));
+
+  // What writev() sends is the flattened archive.
+  std::FILE* file = std::tmpfile();
+  assert(file != nullptr);
+  archive.write_to(fileno(file));
+  std::rewind(file);
+  std::vector<char> written(flat.size() + 1);
+  assert(std::fread(written.data(), 1, written.size(), file) == flat.size());
+  written.pop_back();
+  assert(written == flat);
+  std::fclose(file);
+
+  BinaryInputSerializer in(flat);
+  std::vector<int> a{9}, c, d, f{9};
+  std::string b{"y"}, e;
+  in(a, b, c, d, e, f);
+  assert(a.empty() && b.empty() && c == small && d == large && e == text &&
+         f.empty());
+
+  // Nothing at all but the header.
+  GatherBinaryOutputSerializer header_only;
+  const auto& bare = header_only.get_result();
+  assert(bare.size() == sizeof(std::uint64_t) && bare.iovecs().size() == 1);
+}
+
+// A reader over |bytes| that does not know how much it has left, like a
+// pipe.
+CallbackReader pipe_reader(const std::string& bytes, std::size_t* pos) {
+  return CallbackReader([&bytes, pos](char* data, std::size_t size) {
+    size = std::min(size, bytes.size() - *pos);
+    std::memcpy(data, bytes.data() + *pos, size);
+    *pos += size;
+    return size;
+  });
+}
+
+template <class... Args>
+std::string save_streamed(std::size_t chunk_size, const Args&... args) {
+  std::string bytes;
+  BasicBinaryOutputSerializer<ChunkedSink<CallbackWriter>> ser(
+      ChunkedSink<CallbackWriter>(
+          CallbackWriter([&bytes](const char* data, std::size_t size) {
+            bytes.append(data, size);
+          }),
+          chunk_size));
+  ser(args...);
+  ser.get_result();
+  return bytes;
+}
+
+// Loads the std::vector<float> at the start of |bytes| from a pipe and
+// from a file; true if both threw std::out_of_range.
+bool rejects_floats(const std::string& bytes, std::size_t chunk_size) {
+  int rejected = 0;
+  std::vector<float> out;
+  try {
+    std::size_t pos = 0;
+    BasicBinaryInputSerializer<ChunkedSource<CallbackReader>> in(
+        ChunkedSource<CallbackReader>(pipe_reader(bytes, &pos), chunk_size));
+    in(out);
+  } catch (const std::out_of_range&) {
+    ++rejected;
+  }
+  std::FILE* file = std::tmpfile();
+  std::fwrite(bytes.data(), 1, bytes.size(), file);
+  std::fflush(file);
+  ::lseek(fileno(file), 0, SEEK_SET);
+  try {
+    FdInputSerializer in(ChunkedSource<FdReader>(FdReader(fileno(file))));
+    in(out);
+  } catch (const std::out_of_range&) {
+    ++rejected;
+  }
+  std::fclose(file);
+  return rejected == 2;
+}
+
+void test_stream() {
+  const std::vector<float> empty;
+  const std::vector<float> small{1, 2, 3};
+  const std::vector<float> large(10000, 2.5f);
+  const std::string text(300, 't');
+  for (std::size_t chunk_size : {16, 64, 1 << 16}) {
+    const auto bytes =
+        save_streamed(chunk_size, empty, small, large, std::string(), text);
+    // Streams cannot stamp the size.
+    assert(bytes.size() > 8 && bytes.substr(0, 8) == std::string(8, '\0'));
+
+    std::size_t pos = 0;
+    BasicBinaryInputSerializer<ChunkedSource<CallbackReader>> in(
+        ChunkedSource<CallbackReader>(pipe_reader(bytes, &pos), chunk_size));
+    std::vector<float> a{1}, b, c;
+    std::string d{"x"}, e;
+    in(a, b, c, d, e);
+    assert(a.empty() && b == small && c == large && d.empty() && e == text);
+    assert(pos == bytes.size());
+
+    // The same archive with its size stamped, as a file writer could.
+    auto stamped = bytes;
+    detail::store_header(&stamped[0], stamped.size());
+    pos = 0;
+    BasicBinaryInputSerializer<ChunkedSource<CallbackReader>> stamped_in(
+        ChunkedSource<CallbackReader>(pipe_reader(stamped, &pos), chunk_size));
+    stamped_in(a, b, c, d, e);
+    assert(a.empty() && b == small && c == large && d.empty() && e == text);
+  }
+
+  // Corrupt length prefixes. The length follows the 8-byte header.
+  const auto bytes = save_streamed(64, small);
+  assert(bytes.size() > 16 && detail::load_header(&bytes[8]) == 3);
+  // Longer than the stream but within a chunk: caught by reading ahead.
+  auto corrupt = bytes;
+  detail::store_header(&corrupt[8], 10);
+  assert(rejects_floats(corrupt, 64));
+  // Longer than a chunk: a short read from the pipe, the file size for the
+  // file.
+  detail::store_header(&corrupt[8], 1000);
+  assert(rejects_floats(corrupt, 64));
+  // Absurd, and stamped: rejected before anything is allocated.
+  detail::store_header(&corrupt[8], std::uint64_t{1} << 60);
+  detail::store_header(&corrupt[0], corrupt.size());
+  assert(rejects_floats(corrupt, 64));
+  // Truncated.
+  assert(rejects_floats(bytes.substr(0, bytes.size() - 1), 64));
+}
+
+// Fixed layouts: records of scalars and fixed-size arrays, with the padding
+// the arrays get field by field.
+struct Sample {
+  std::int32_t id{0};
+  std::array<float, 3> pos{};
+  float vel[3]{};
+  std::uint8_t kind{0};
+  TI_IO_FIELDS(id, pos, vel, kind);
+
+  bool operator==(const Sample& o) const {
+    return id == o.id && pos == o.pos && std::equal(vel, vel + 3, o.vel) &&
+           kind == o.kind;
+  }
+};
+
+struct Padded {
+  std::uint8_t kind{0};
+  float v[3]{};
+  TI_IO_FIELDS(kind, v);
+
+  bool operator==(const Padded& o) const {
+    return kind == o.kind && std::equal(v, v + 3, o.v);
+  }
+};
+
+struct Nested {
+  std::array<Padded, 2> parts{};
+  double weight{0.0};
+  TI_IO_FIELDS(parts, weight);
+
+  bool operator==(const Nested& o) const {
+    return parts == o.parts && weight == o.weight;
+  }
+};
+
+using Out = BinaryOutputSerializer;
+using CompactOut = CompactBinaryOutputSerializer;
+
+static_assert(detail::fixed_size<Out, float[3]>() == 12);
+static_assert(detail::fixed_size<Out, std::array<float, 3>>() == 12);
+static_assert(detail::fixed_size<Out, Sample>() == 4 + 12 + 12 + 1);
+static_assert(detail::fixed_align<Out, Sample>() == 4);
+static_assert(detail::fixed_size<Out, Padded>() == 1 + 3 + 12);
+static_assert(detail::fixed_size<Out, Nested>() == 16 + 16 + 8);
+static_assert(detail::fixed_size<Out, std::string>() == 0);
+// Varint integers have no fixed width.
+static_assert(detail::fixed_size<CompactOut, Sample>() == 0);
+
+// The archive body with no header, written field by field: a ChunkedSink
+// cannot claim, so it never takes the fixed-layout path.
+template <class Format, class... Ts>
+std::string save_by_field(const Ts&... values) {
+  std::string bytes;
+  BasicBinaryOutputSerializer<ChunkedSink<CallbackWriter>, Format> ser(
+      CallbackWriter([&](const char* data, std::size_t size) {
+        bytes.append(data, size);
+      }));
+  ser(values...);
+  ser.get_result();
+  return bytes.substr(8);
+}
+
+template <class Format, class... Ts>
+std::string save_fixed_layout(const Ts&... values) {
+  BasicBinaryOutputSerializer<VectorSink, Format> ser;
+  ser(values...);
+  const auto& archive = ser.get_result();
+  return std::string(archive.begin() + 8, archive.end());
+}
+
+template <class Format, class T>
+void check_fixed_round_trip(const T& value, const std::vector<T>& values) {
+  // Aligned and not: a leading byte moves everything after it by one.
+  const std::uint8_t shift = 9;
+  const auto by_field = save_by_field<Format>(value, values, shift, value,
+                                              values);
+  const auto fixed = save_fixed_layout<Format>(value, values, shift, value,
+                                               values);
+  assert(by_field == fixed);
+
+  std::vector<char> archive(8);
+  archive.insert(archive.end(), fixed.begin(), fixed.end());
+  detail::store_header(archive.data(), archive.size());
+  BasicBinaryInputSerializer<BufferSource, Format> in(archive);
+  T a, c;
+  std::vector<T> b, d;
+  std::uint8_t s = 0;
+  in(a, b, s, c, d);
+  assert(a == value && b == values && s == shift && c == value &&
+         d == values);
+  assert(in.remaining() == 0);
+}
+
+void test_fixed_layout() {
+  Sample sample;
+  sample.id = -7;
+  sample.pos = {1.0f, 2.0f, 3.0f};
+  sample.vel[0] = 4.0f;
+  sample.vel[1] = 5.0f;
+  sample.vel[2] = 6.0f;
+  sample.kind = 3;
+  std::vector<Sample> samples(5, sample);
+  samples[2].pos[1] = -1.0f;
+
+  Padded padded;
+  padded.kind = 1;
+  padded.v[2] = 0.5f;
+  std::vector<Padded> paddeds(4, padded);
+  paddeds[3].kind = 2;
+
+  Nested nested;
+  nested.parts[1] = padded;
+  nested.weight = 2.5;
+  const std::vector<Nested> nesteds(3, nested);
+
+  check_fixed_round_trip<NativeFormat>(sample, samples);
+  check_fixed_round_trip<NativeFormat>(padded, paddeds);
+  check_fixed_round_trip<NativeFormat>(nested, nesteds);
+  check_fixed_round_trip<BigEndianFormat>(sample, samples);
+  check_fixed_round_trip<BigEndianFormat>(padded, paddeds);
+  check_fixed_round_trip<BigEndianFormat>(nested, nesteds);
+  check_fixed_round_trip<NativeFormat>(sample, std::vector<Sample>());
+
+  // Truncated: the fixed path declines and the field-by-field one throws.
+  auto truncated = save_fixed_layout<NativeFormat>(paddeds);
+  truncated.pop_back();
+  std::vector<char> archive(8);
+  archive.insert(archive.end(), truncated.begin(), truncated.end());
+  bool threw = false;
+  try {
+    BinaryInputSerializer in(archive);
+    std::vector<Padded> out;
+    in(out);
+  } catch (const std::out_of_range&) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+template <class Fn>
+bool throws_out_of_range(Fn&& fn) {
+  try {
+    fn();
+  } catch (const std::out_of_range&) {
+    return true;
+  }
+  return false;
+}
+
+// Zero-copy loads out of a borrowed buffer, and headers and lengths that do
+// not fit it.
+void test_buffer_source() {
+  const std::vector<double> doubles{1.5, -2.5, 4.0};
+  const std::string text = "hello";
+  const auto archive = serialize(doubles, text, std::vector<int>());
+
+  BinaryInputSerializer in(archive);
+  ArrayView<double> view;
+  std::string_view sv;
+  ArrayView<int> empty;
+  in(view, sv, empty);
+  assert(std::equal(view.begin(), view.end(), doubles.begin(),
+                    doubles.end()));
+  assert(view.data() > reinterpret_cast<const double*>(archive.data()));
+  assert(sv == text && sv.data() > archive.data() &&
+         sv.data() < archive.data() + archive.size());
+  assert(empty.empty());
+  assert(in.remaining() == 0);
+
+  // The header claims more than the buffer holds.
+  auto corrupt = archive;
+  detail::store_header(corrupt.data(), corrupt.size() + 1);
+  assert(throws_out_of_range([&] { BinaryInputSerializer bad(corrupt); }));
+  // Shorter than a header.
+  assert(throws_out_of_range(
+      [&] { BinaryInputSerializer bad(archive.data(), 7); }));
+  // A length past the end.
+  corrupt = archive;
+  detail::store_header(&corrupt[8], std::uint64_t{1} << 40);
+  assert(throws_out_of_range([&] {
+    BinaryInputSerializer bad(corrupt);
+    std::vector<double> out;
+    bad(out);
+  }));
+}
+
+// The size pass matches what is written, and a buffer one byte short throws.
+void test_two_phase() {
+  const std::vector<float> floats(100, 0.25f);
+  const std::map<std::string, int> map{{"a", 1}, {"bc", 2}};
+  BinaryOutputSerializer ser;
+  ser(floats, map, std::string("x"));
+  const auto& expected = ser.get_result();
+  assert(serialized_size(floats, map, std::string("x")) == expected.size());
+  assert(serialize(floats, map, std::string("x")) == expected);
+
+  std::vector<char> buffer(expected.size());
+  assert(serialize_into(buffer.data(), buffer.size(), floats, map,
+                        std::string("x")) == expected.size());
+  assert(buffer == expected);
+  assert(throws_out_of_range([&] {
+    serialize_into(buffer.data(), buffer.size() - 1, floats, map,
+                   std::string("x"));
+  }));
+}
+
+// Bulk ranges come out padded to their alignment and read back as they went
+// in.
+void test_bulk() {
+  const std::vector<std::uint8_t> bytes{1, 2, 3};
+  const std::vector<double> doubles{1.0, 2.0};
+  const std::array<std::int32_t, 4> ints{-1, 2, -3, 4};
+  const std::uint16_t shorts[3] = {7, 8, 9};
+  const std::vector<std::array<float, 2>> pairs{{1, 2}, {3, 4}};
+  const auto archive = serialize(bytes, doubles, ints, shorts, pairs);
+
+  BinaryInputSerializer in(archive);
+  std::vector<std::uint8_t> a;
+  ArrayView<double> b;
+  std::array<std::int32_t, 4> c{};
+  std::uint16_t d[3] = {};
+  std::vector<std::array<float, 2>> e;
+  in(a, b, c, d, e);
+  assert(a == bytes && c == ints && std::equal(d, d + 3, shorts) &&
+         e == pairs);
+  assert(std::equal(b.begin(), b.end(), doubles.begin(), doubles.end()));
+  assert((reinterpret_cast<const char*>(b.data()) - archive.data()) %
+             alignof(double) ==
+         0);
+}
+
+// Varints: small magnitudes of either sign are short, extremes round-trip,
+// and runaway or truncated varints throw.
+void test_compact() {
+  const std::vector<std::int64_t> ints{0,
+                                       -1,
+                                       1,
+                                       -64,
+                                       64,
+                                       std::numeric_limits<std::int64_t>::min(),
+                                       std::numeric_limits<std::int64_t>::max()};
+  const std::vector<std::uint32_t> counts(100, 5);
+  const std::string text = "compact";
+  CompactBinaryOutputSerializer ser;
+  ser(ints, counts, text);
+  const auto& archive = ser.get_result();
+  assert(archive.size() < serialized_size(ints, counts, text));
+
+  CompactBinaryInputSerializer in(archive);
+  std::vector<std::int64_t> a;
+  std::vector<std::uint32_t> b;
+  std::string c;
+  in(a, b, c);
+  assert(a == ints && b == counts && c == text);
+
+  // Eleven continuation bytes.
+  std::vector<char> runaway(8);
+  runaway.insert(runaway.end(), 11, static_cast<char>(0xff));
+  assert(throws_out_of_range([&] {
+    CompactBinaryInputSerializer bad(runaway);
+    std::uint64_t v = 0;
+    bad(v);
+  }));
+  // Cut short mid-varint.
+  std::vector<char> truncated(8);
+  truncated.push_back(static_cast<char>(0x80));
+  assert(throws_out_of_range([&] {
+    CompactBinaryInputSerializer bad(truncated);
+    std::uint64_t v = 0;
+    bad(v);
+  }));
+}
+
+// Text round trips, shortest floats included; JSON output is checked as
+// text.
+void test_text() {
+  const std::vector<double> doubles{0.1, -2.5, 1e300};
+  const std::vector<bool> bools{true, false};
+  const std::string text = "two words";
+  TextOutputSerializer out;
+  out(std::int64_t{-42}, doubles, bools, text, std::string());
+  const std::string archive = out.get_result();
+  assert(archive.find("0.1\n") != std::string::npos);
+
+  TextInputSerializer in(archive);
+  std::int64_t a = 0;
+  std::vector<double> b;
+  std::vector<bool> c;
+  std::string d, e{"x"};
+  in(a, b, c, d, e);
+  assert(a == -42 && b == doubles && c == bools && d == text && e.empty());
+  assert(in.remaining() == 0);
+
+  // Windows line breaks.
+  TextInputSerializer crlf("7\r\nabc\r\n");
+  int n = 0;
+  std::string s;
+  crlf(n, s);
+  assert(n == 7 && s == "abc");
+
+  assert(throws_out_of_range([] {
+    TextInputSerializer bad("");
+    int v = 0;
+    bad(v);
+  }));
+  assert(throws_out_of_range([] {
+    TextInputSerializer bad("12x\n");
+    int v = 0;
+    bad(v);
+  }));
+  assert(throws_out_of_range([] {
+    TextInputSerializer bad("2\n");
+    bool v = false;
+    bad(v);
+  }));
+
+  JsonOutputSerializer json;
+  const std::map<std::string, std::optional<int>> map{{"a", 1},
+                                                      {"b\"", std::nullopt}};
+  json(map, std::make_pair(1, std::string("x")), std::vector<int>());
+  assert(json.get_result() == "{\"a\":1,\"b\\\"\":null}\n[1,\"x\"]\n[]");
+}
+
+struct Scene {
+  std::string name;
+  Lazy<std::vector<int>> mesh;
+  Lazy<std::string> notes;
+  TI_IO_FIELDS(name, mesh, notes);
+};
+
+// Lazy fields stay encoded until asked for from memory, decode right away
+// from a stream, and pass through a re-save untouched.
+void test_lazy() {
+  Scene scene;
+  scene.name = "scene";
+  scene.mesh = std::vector<int>(1000, 3);
+  scene.notes = std::string();
+  const auto archive = serialize(scene);
+
+  Scene loaded;
+  BinaryInputSerializer in(archive);
+  in(loaded);
+  assert(loaded.name == "scene" && !loaded.mesh.decoded());
+  const auto& mesh = loaded.mesh;
+  assert(mesh.get() == *scene.mesh && loaded.notes.get().empty());
+  assert(serialize(loaded) == archive);
+
+  std::string bytes(archive.begin(), archive.end());
+  std::size_t pos = 0;
+  BasicBinaryInputSerializer<ChunkedSource<CallbackReader>> streamed(
+      ChunkedSource<CallbackReader>(pipe_reader(bytes, &pos), 64));
+  Scene from_stream;
+  streamed(from_stream);
+  assert(from_stream.mesh.decoded() && from_stream.mesh.get() == *scene.mesh);
+
+  // An embedded archive whose size is too small to hold its own header. The
+  // mesh's starts after the header and the name, 16-byte aligned.
+  auto corrupt = archive;
+  const std::size_t at = 32;
+  assert(detail::load_header(&corrupt[at]) == serialized_size(*scene.mesh));
+  detail::store_header(&corrupt[at], 3);
+  assert(throws_out_of_range([&] {
+    BinaryInputSerializer bad(corrupt);
+    Scene s;
+    bad(s);
+  }));
+}
+
+// Top-level fields and vector elements decoded one at a time, and offset
+// tables that point outside the archive.
+void test_indexed() {
+  BinaryOutputSerializer ser;
+  const std::vector<std::string> words{"a", "", "ccc", "dddd"};
+  save_indexed(ser, std::string("first"), words, 42);
+  const auto& archive = ser.get_result();
+
+  LazyArchive<> lazy(archive.data(), archive.size());
+  assert(lazy.num_fields() == 3);
+  assert(lazy.get<int>(2) == 42);
+  assert(lazy.get<std::string>(0) == "first");
+  assert(lazy.get<std::vector<std::string>>(1) == words);
+  assert(throws_out_of_range([&] { lazy.offset(3); }));
+
+  // A field count the archive cannot hold.
+  auto corrupt = archive;
+  detail::store_header(&corrupt[corrupt.size() - 8], corrupt.size());
+  assert(throws_out_of_range(
+      [&] { LazyArchive<> bad(corrupt.data(), corrupt.size()); }));
+
+  const std::vector<std::string> no_words;
+  const auto indexed = serialize(IndexedView<std::string>(words),
+                                 IndexedView<std::string>(no_words));
+  BinaryInputSerializer in(indexed);
+  IndexedView<std::string> view, empty;
+  in(view, empty);
+  assert(view.size() == 4 && view.source() == nullptr);
+  assert(view.at(2) == "ccc" && view.at(1).empty());
+  assert(view.range(1, 4) ==
+         std::vector<std::string>(words.begin() + 1, words.end()));
+  assert(empty.empty() && empty.range(0, 0).empty());
+  assert(throws_out_of_range([&] { view.at(4); }));
+
+  // From a source that cannot view, the view keeps its own copy.
+  std::string bytes(indexed.begin(), indexed.end());
+  std::size_t pos = 0;
+  BasicBinaryInputSerializer<ChunkedSource<CallbackReader>> streamed(
+      ChunkedSource<CallbackReader>(pipe_reader(bytes, &pos), 64));
+  IndexedView<std::string> copied;
+  streamed(copied);
+  assert(copied.at(3) == "dddd");
+
+  // Element 0's offset pointing past the embedded archive, which ends the
+  // outer one: the offsets come right before the count in the last 8 bytes.
+  auto bad_offset = serialize(IndexedView<std::string>(words));
+  detail::store_header(&bad_offset[bad_offset.size() - 8 * (words.size() + 1)],
+                       std::uint64_t{1} << 40);
+  BinaryInputSerializer bad_in(bad_offset);
+  IndexedView<std::string> bad_view;
+  bad_in(bad_view);
+  assert(bad_view.at(1).empty());
+  assert(throws_out_of_range([&] { bad_view.at(0); }));
+}
+
+// Chunked concurrent saves decode the same with any thread count, and chunk
+// indexes that do not add up throw.
+void test_parallel() {
+  std::vector<std::string> words(1000);
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    words[i] = std::string(i % 7, static_cast<char>('a' + i % 26));
+  }
+  for (std::size_t threads : {1, 4}) {
+    for (std::size_t chunk_len : {0, 1, 33, 5000}) {
+      BinaryOutputSerializer ser;
+      save_parallel(ser, words, threads, chunk_len);
+      const auto& archive = ser.get_result();
+      BinaryInputSerializer in(archive);
+      std::vector<std::string> out{"stale"};
+      load_parallel(in, out, 3);
+      assert(out == words);
+    }
+  }
+
+  BinaryOutputSerializer empty_ser;
+  save_parallel(empty_ser, std::vector<int>(), 2);
+  const auto& empty = empty_ser.get_result();
+  BinaryInputSerializer empty_in(empty);
+  std::vector<int> none{1};
+  load_parallel(empty_in, none);
+  assert(none.empty());
+
+  BinaryOutputSerializer ser;
+  save_parallel(ser, std::vector<int>(100, 1), 2, 10);
+  auto corrupt = ser.get_result();
+  // The chunk count follows the element count and the chunk length.
+  detail::store_header(&corrupt[16 + 16], 11);
+  assert(throws_out_of_range([&] {
+    BinaryInputSerializer in(corrupt);
+    std::vector<int> out;
+    load_parallel(in, out);
+  }));
+  // The first chunk's offset.
+  corrupt = ser.get_result();
+  detail::store_header(&corrupt[16 + 24], 16 * 1000);
+  assert(throws_out_of_range([&] {
+    BinaryInputSerializer in(corrupt);
+    std::vector<int> out;
+    load_parallel(in, out);
+  }));
+}
+
+struct State {
+  std::vector<int> big;
+  std::string label;
+  TI_IO_FIELDS(big, label);
+};
+
+// Deltas only carry changed chunks and rebuild the latest state; a delta
+// applied out of order throws.
+void test_delta() {
+  State state;
+  state.big.assign(10000, 1);
+  state.label = "v0";
+  DeltaWriter<> writer(256);
+  std::vector<std::vector<char>> snapshots;
+  for (int v = 0; v < 3; ++v) {
+    if (v > 0) {
+      state.big[v * 1000] = v;
+      state.label = "v" + std::to_string(v);
+    }
+    BinaryOutputSerializer ser;
+    writer.save(ser, state);
+    snapshots.push_back(ser.get_result());
+  }
+  assert(writer.sequence() == 2);
+  assert(snapshots[1].size() < snapshots[0].size() / 10);
+
+  DeltaReader<> reader;
+  for (const auto& snapshot : snapshots) {
+    BinaryInputSerializer in(snapshot);
+    reader.apply(in);
+  }
+  State loaded;
+  reader.load(loaded);
+  assert(loaded.big == state.big && loaded.label == state.label);
+
+  // A delta with no base, and one applied twice.
+  assert(throws_out_of_range([&] {
+    DeltaReader<> fresh;
+    BinaryInputSerializer in(snapshots[1]);
+    fresh.apply(in);
+  }));
+  assert(throws_out_of_range([&] {
+    BinaryInputSerializer in(snapshots[2]);
+    reader.apply(in);
+  }));
+  assert(throws_out_of_range([] {
+    DeltaReader<> fresh;
+    State s;
+    fresh.load(s);
+  }));
+}
+
+// Strings and their vector come out of the arena.
+void test_arena() {
+  const std::vector<std::string> words{"short", std::string(100, 'l'), ""};
+  const auto archive = serialize(words);
+  DecodeArena arena(archive.size());
+  auto loaded = arena.make<std::pmr::vector<std::pmr::string>>();
+  BinaryInputSerializer in(archive);
+  in(loaded);
+  assert(loaded.size() == words.size());
+  for (std::size_t i = 0; i < words.size(); ++i) {
+    assert(std::string_view(loaded[i]) == words[i]);
+    assert(loaded[i].get_allocator().resource() == arena.resource());
+  }
+  assert(loaded.get_allocator().resource() == arena.resource());
+}
+
+// Compressed round trips across block boundaries, empty archives, and
+// corrupt trailers and blocks.
+void test_compress() {
+  std::vector<float> floats(50000);
+  for (std::size_t i = 0; i < floats.size(); ++i) {
+    floats[i] = static_cast<float>(i % 100);
+  }
+  const std::string text(5000, 'z');
+  for (std::size_t block_size : {64, 1 << 16}) {
+    BasicBinaryOutputSerializer<CompressingSink<VectorSink>> ser(
+        CompressingSink<VectorSink>(VectorSink(), block_size));
+    ser(floats, text, std::vector<int>());
+    const auto archive = ser.get_result();
+    // Small blocks cost more in framing than they save.
+    if (block_size > 64) {
+      assert(archive.size() <
+             serialized_size(floats, text, std::vector<int>()) / 2);
+    }
+
+    CompressedBinaryInputSerializer in(archive);
+    std::vector<float> a;
+    std::string b;
+    std::vector<int> c{1};
+    in(a, b, c);
+    assert(a == floats && b == text && c.empty());
+
+    // The raw archive inside leaves its header 0.
+    const CompressedArchive<> container(archive);
+    const auto raw = container.decompress(4);
+    const auto expected = serialize(floats, text, std::vector<int>());
+    assert(raw.size() == expected.size() &&
+           std::equal(raw.begin() + 8, raw.end(), expected.begin() + 8));
+  }
+
+  CompressedBinaryOutputSerializer empty_ser;
+  const auto empty = empty_ser.get_result();
+  CompressedBinaryInputSerializer empty_in(empty);
+  assert(CompressedArchive<>(empty).raw_size() == sizeof(std::uint64_t));
+
+  CompressedBinaryOutputSerializer ser;
+  ser(floats);
+  const auto archive = ser.get_result();
+  // The trailer ends the container: raw size, block size, codec, count.
+  auto corrupt = archive;
+  detail::store_header(&corrupt[corrupt.size() - 16], 99);
+  assert(throws_out_of_range([&] { CompressedArchive<> bad(corrupt); }));
+  corrupt = archive;
+  detail::store_header(&corrupt[corrupt.size() - 8], 1000);
+  assert(throws_out_of_range([&] { CompressedArchive<> bad(corrupt); }));
+  // The first block starts right after the container header; lie about the
+  // size it decompresses to.
+  corrupt = archive;
+  corrupt[8] ^= 1;
+  assert(throws_out_of_range([&] {
+    CompressedBinaryInputSerializer in(corrupt);
+    std::vector<float> out;
+    in(out);
+  }));
+  assert(throws_out_of_range(
+      [&] { CompressedArchive<>(archive.data(), 20); }));
+}
+
+// CRCs catch a flipped bit in any block, lazily or up front, and a trailer
+// that does not fit the container.
+void test_checksum() {
+  const std::vector<double> doubles(5000, 0.5);
+  BasicBinaryOutputSerializer<ChecksummedSink<VectorSink>> ser(
+      ChecksummedSink<VectorSink>(VectorSink(), 1024));
+  ser(std::string("head"), doubles);
+  const auto archive = ser.get_result();
+
+  ChecksummedBinaryInputSerializer in(archive);
+  std::string head;
+  ArrayView<double> view;
+  in(head, view);
+  assert(head == "head" &&
+         std::equal(view.begin(), view.end(), doubles.begin(), doubles.end()));
+
+  auto corrupt = archive;
+  corrupt[30000] ^= 4;
+  // Only the first blocks are read, so nothing is noticed...
+  ChecksummedBinaryInputSerializer partial(corrupt);
+  std::string h;
+  partial(h);
+  assert(h == "head");
+  // ...until the damaged one is.
+  assert(throws_out_of_range([&] {
+    ChecksummedBinaryInputSerializer bad(corrupt);
+    std::string s;
+    std::vector<double> d;
+    bad(s, d);
+  }));
+  assert(throws_out_of_range([&] {
+    ChecksummedSource source(corrupt);
+    source.verify_all();
+  }));
+  // Damage to the first block shows as soon as the header is read.
+  corrupt = archive;
+  corrupt[9] ^= 1;
+  assert(throws_out_of_range([&] {
+    ChecksummedBinaryInputSerializer bad(corrupt);
+  }));
+  // A block count that does not match the raw size.
+  corrupt = archive;
+  detail::store_header(&corrupt[corrupt.size() - 8], 1);
+  assert(throws_out_of_range([&] { ChecksummedSource bad(corrupt); }));
+
+  ChecksummedBinaryOutputSerializer empty_ser;
+  const auto empty = empty_ser.get_result();
+  ChecksummedSource empty_source(empty);
+  empty_source.verify_all();
+}
+
+// Big-endian archives hold big-endian bytes whatever the host, and
+// round-trip scalars, bulk ranges and maps.
+void test_big_endian() {
+  BasicBinaryOutputSerializer<VectorSink, BigEndianFormat> ser;
+  const std::uint32_t word = 0x01020304;
+  const std::vector<std::uint16_t> shorts{0x0102, 0x0304, 0x0506};
+  const std::vector<double> doubles{1.0, -0.5};
+  const std::map<std::int32_t, float> map{{1, 1.5f}, {-2, 2.5f}};
+  ser(word, shorts, doubles, map);
+  const auto archive = ser.get_result();
+  // The header is little-endian, like every size in the framing.
+  assert(detail::load_header(archive.data()) == archive.size());
+  assert(std::memcmp(&archive[8], "\x01\x02\x03\x04", 4) == 0);
+
+  BasicBinaryInputSerializer<BufferSource, BigEndianFormat> in(archive);
+  std::uint32_t a = 0;
+  std::vector<std::uint16_t> b;
+  std::vector<double> c;
+  std::map<std::int32_t, float> d;
+  in(a, b, c, d);
+  assert(a == word && b == shorts && c == doubles && d == map);
+
+  // The same through a stream, which swaps in place.
+  std::string bytes;
+  BasicBinaryOutputSerializer<ChunkedSink<CallbackWriter>, BigEndianFormat>
+      streamed(CallbackWriter(
+          [&](const char* data, std::size_t size) { bytes.append(data, size); }));
+  streamed(word, shorts, doubles, map);
+  streamed.get_result();
+  assert(bytes.substr(8) == std::string(archive.begin() + 8, archive.end()));
+  std::size_t pos = 0;
+  BasicBinaryInputSerializer<ChunkedSource<CallbackReader>, BigEndianFormat>
+      streamed_in(ChunkedSource<CallbackReader>(pipe_reader(bytes, &pos)));
+  streamed_in(a, b, c, d);
+  assert(a == word && b == shorts && c == doubles && d == map);
+}
+
+// std::vector<bool> has no contiguous storage and goes element by element.
+void test_vector_bool() {
+  const std::vector<bool> bools{true, false, false, true, true};
+  const auto archive = serialize(bools, std::vector<bool>());
+  BinaryInputSerializer in(archive);
+  std::vector<bool> a, b{true};
+  in(a, b);
+  assert(a == bools && b.empty());
+
+  CompactBinaryOutputSerializer compact;
+  compact(bools);
+  CompactBinaryInputSerializer compact_in(compact.get_result());
+  std::vector<bool> c;
+  compact_in(c);
+  assert(c == bools);
+}
+
+// Maps of plain keys and values are stored as two columns; from a source
+// that cannot view, they are read into temporary columns first.
+void test_columnar_map() {
+  std::map<std::int32_t, double> map;
+  std::unordered_map<std::uint64_t, std::int16_t> hashed;
+  for (int i = 0; i < 100; ++i) {
+    map[i * 3 - 50] = i * 0.5;
+    hashed[std::uint64_t{1} << (i % 64) | i] = static_cast<std::int16_t>(-i);
+  }
+  const std::map<std::int32_t, double> empty;
+  const auto archive = serialize(map, hashed, empty);
+
+  BinaryInputSerializer in(archive);
+  std::map<std::int32_t, double> a, c{{1, 1.0}};
+  std::unordered_map<std::uint64_t, std::int16_t> b;
+  in(a, b, c);
+  assert(a == map && b == hashed && c.empty());
+
+  std::string bytes(archive.begin(), archive.end());
+  std::size_t pos = 0;
+  BasicBinaryInputSerializer<ChunkedSource<CallbackReader>> streamed(
+      ChunkedSource<CallbackReader>(pipe_reader(bytes, &pos), 64));
+  streamed(a, b, c);
+  assert(a == map && b == hashed && c.empty());
+
+  // A size past the end of the archive.
+  auto corrupt = archive;
+  detail::store_header(&corrupt[8], std::uint64_t{1} << 40);
+  assert(throws_out_of_range([&] {
+    BinaryInputSerializer bad(corrupt);
+    bad(a);
+  }));
+}
+
+}  // namespace
+
+int main() {
+  test_buffer_source();
+  test_two_phase();
+  test_bulk();
+  test_stream();
+  test_compact();
+  test_text();
+  test_lazy();
+  test_parallel();
+  test_delta();
+  test_indexed();
+  test_arena();
+  test_compress();
+  test_checksum();
+  test_big_endian();
+  test_fixed_layout();
+  test_vector_bool();
+  test_gather();
+  test_columnar_map();
+  std::puts("ok");
+}
@@ -1,33 +1,107 @@
 #pragma once
 
-#include <sstream>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "serializer.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace taichi {
+namespace detail {
+
+// Growable char buffer that numbers are formatted into in place with
+// std::to_chars: no temporary strings, no locale, no stream state. Floating
+// point values use the shortest representation that round-trips.
+class TextBuffer {
+ public:
+  void append(std::string_view s) { buffer_.append(s.data(), s.size()); }
+  void append(char c) { buffer_.push_back(c); }
+
+  template <typename T>
+  void append_number(const T &t) {
+    // Enough for any integer or shortest round-trip floating point value.
+    constexpr std::size_t kMaxChars = 64;
+    const auto old_size = buffer_.size();
+    buffer_.resize(old_size + kMaxChars);
+    auto *first = buffer_.data() + old_size;
+    const auto res = std::to_chars(first, first + kMaxChars, t);
+    buffer_.resize(res.ptr - buffer_.data());
+  }
+
+  const std::string &str() const { return buffer_; }
+
+ private:
+  std::string buffer_;
+};
+
+// Returns the first '\n' in [first, last), or |last|. Scans sixteen bytes at
+// a time where SSE2 is available.
+inline const char *find_newline(const char *first, const char *last) {
+#if defined(__SSE2__)
+  const auto newline = _mm_set1_epi8('\n');
+  for (; last - first >= 16; first += 16) {
+    const auto block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+    if (mask != 0) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; first != last; ++first) {
+    if (*first == '\n') {
+      return first;
+    }
+  }
+  return last;
+}
 
+}  // namespace detail
+
+// One value per line.
 class TextOutputSerializer : public OutputSerializer<TextOutputSerializer> {
  public:
   TextOutputSerializer() : OutputSerializer<TextOutputSerializer>(this) {}
 
-  void save_value(const std::string &s) { this->add_to_line(s); }
+  void save_value(std::string_view s) {
+    buffer_.append(s);
+    buffer_.append('\n');
+  }
+
+  void save_value(bool b) {
+    buffer_.append(b ? '1' : '0');
+    buffer_.append('\n');
+  }
 
   template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
   void save_value(const T &i) {
-    this->add_to_line(std::to_string(i));
+    buffer_.append_number(i);
+    buffer_.append('\n');
   }
 
-  std::string get_result() const { return buffer_.str(); }
+  const std::string &get_result() const { return buffer_.str(); }
 
  private:
-  void add_to_line(const std::string &s) { buffer_ << s << std::endl; }
-
-  std::stringstream buffer_;
+  detail::TextBuffer buffer_;
 };
 
-void save(TextOutputSerializer &ser, const std::string &s) {
-  ser.save_value(s);
+template <typename Tr, typename A>
+void save(TextOutputSerializer &ser, const std::basic_string<char, Tr, A> &s) {
+  ser.save_value(std::string_view(s.data(), s.size()));
 }
 
 template <typename T,
@@ -36,4 +110,295 @@ inline void save(TextOutputSerializer &ser, const T &t) {
   ser.save_value(t);
 }
 
-}  // namespace taichi
\ No newline at end of file
+// Reads what TextOutputSerializer writes, straight out of a caller-owned
+// buffer: lines are found with a vectorized newline scan and numbers parsed
+// with std::from_chars, so there are no streams, no locale and no copies of
+// the text. A trailing '\r' is dropped from every line, so that archives
+// edited on Windows still load; strings that contain a newline do not round
+// trip.
+class TextInputSerializer : public InputSerializer<TextInputSerializer> {
+ public:
+  TextInputSerializer(const char *data, std::size_t size)
+      : InputSerializer<TextInputSerializer>(this),
+        cur_(data),
+        end_(data + size) {}
+  explicit TextInputSerializer(std::string_view text)
+      : TextInputSerializer(text.data(), text.size()) {}
+
+  // Consumes the next line and returns it without its line break. The view
+  // points into the caller's buffer.
+  std::string_view load_line() {
+    if (cur_ == end_) {
+      throw std::out_of_range("text archive: read past end");
+    }
+    const char *eol = detail::find_newline(cur_, end_);
+    std::string_view line(cur_, eol - cur_);
+    cur_ = eol == end_ ? eol : eol + 1;
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    return line;
+  }
+
+  void load_value(bool &b) {
+    const auto line = load_line();
+    if (line == "1") {
+      b = true;
+    } else if (line == "0") {
+      b = false;
+    } else {
+      throw std::out_of_range("text archive: bad bool");
+    }
+  }
+
+  template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+  void load_value(T &t) {
+    const auto line = load_line();
+    const auto *last = line.data() + line.size();
+    const auto res = std::from_chars(line.data(), last, t);
+    if (res.ec != std::errc() || res.ptr != last) {
+      throw std::out_of_range("text archive: bad number");
+    }
+  }
+
+  // Bytes left to parse.
+  std::size_t remaining() const { return end_ - cur_; }
+
+ private:
+  const char *cur_;
+  const char *end_;
+};
+
+template <typename Tr, typename A>
+void load(TextInputSerializer &ser, std::basic_string<char, Tr, A> &s) {
+  const auto line = ser.load_line();
+  s.assign(line.data(), line.size());
+}
+
+// Zero-copy: |s| ends up pointing into the archive text.
+inline void load(TextInputSerializer &ser, std::string_view &s) {
+  s = ser.load_line();
+}
+
+template <typename T,
+          typename = std::enable_if_t<std::is_arithmetic_v<T>, void>>
+inline void load(TextInputSerializer &ser, T &t) {
+  ser.load_value(t);
+}
+
+// Emits JSON. Objects with io(), all sequence types and pairs become JSON
+// arrays (io() does not name its fields), maps become JSON objects and empty
+// optionals null; separate top-level values are written one per line.
+// Non-finite floating point values are written as null.
+class JsonOutputSerializer : public OutputSerializer<JsonOutputSerializer> {
+ public:
+  JsonOutputSerializer() : OutputSerializer<JsonOutputSerializer>(this) {}
+
+  void save_value(std::string_view s) {
+    begin_value();
+    append_string(s);
+  }
+
+  void save_value(bool b) {
+    begin_value();
+    buffer_.append(b ? "true" : "false");
+  }
+
+  template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+  void save_value(const T &t) {
+    begin_value();
+    if constexpr (std::is_floating_point_v<T>) {
+      if (!std::isfinite(t)) {
+        buffer_.append("null");
+        return;
+      }
+    }
+    buffer_.append_number(t);
+  }
+
+  void save_null() {
+    begin_value();
+    buffer_.append("null");
+  }
+
+  void begin_array() {
+    begin_value();
+    buffer_.append('[');
+    ++depth_;
+    first_ = true;
+  }
+
+  void end_array() {
+    buffer_.append(']');
+    --depth_;
+    first_ = false;
+  }
+
+  void begin_object() {
+    begin_value();
+    buffer_.append('{');
+    ++depth_;
+    first_ = true;
+  }
+
+  void end_object() {
+    buffer_.append('}');
+    --depth_;
+    first_ = false;
+  }
+
+  // Inside an object: the member name that the next value goes with.
+  void save_key(std::string_view key) {
+    begin_value();
+    append_string(key);
+    buffer_.append(':');
+    first_ = true;
+  }
+
+  // Hooks called by OutputSerializer around io().
+  void enter_io() { begin_array(); }
+  void leave_io() { end_array(); }
+
+  const std::string &get_result() const { return buffer_.str(); }
+
+ private:
+  void begin_value() {
+    if (!first_) {
+      buffer_.append(depth_ == 0 ? '\n' : ',');
+    }
+    first_ = false;
+  }
+
+  void append_string(std::string_view s) {
+    buffer_.append('"');
+    for (const char c : s) {
+      switch (c) {
+        case '"':
+          buffer_.append("\\\"");
+          break;
+        case '\\':
+          buffer_.append("\\\\");
+          break;
+        case '\n':
+          buffer_.append("\\n");
+          break;
+        case '\t':
+          buffer_.append("\\t");
+          break;
+        case '\r':
+          buffer_.append("\\r");
+          break;
+        default:
+          if (static_cast<unsigned char>(c) < 0x20) {
+            constexpr char kHex[] = "0123456789abcdef";
+            buffer_.append("\\u00");
+            buffer_.append(kHex[c >> 4]);
+            buffer_.append(kHex[c & 0xf]);
+          } else {
+            buffer_.append(c);
+          }
+      }
+    }
+    buffer_.append('"');
+  }
+
+  detail::TextBuffer buffer_;
+  int depth_{0};
+  bool first_{true};
+};
+
+template <typename Tr, typename A>
+void save(JsonOutputSerializer &ser, const std::basic_string<char, Tr, A> &s) {
+  ser.save_value(std::string_view(s.data(), s.size()));
+}
+
+template <typename T,
+          typename = std::enable_if_t<std::is_arithmetic_v<T>, void>>
+inline void save(JsonOutputSerializer &ser, const T &t) {
+  ser.save_value(t);
+}
+
+template <typename T, typename A>
+void save(JsonOutputSerializer &ser, const std::vector<T, A> &vec) {
+  ser.begin_array();
+  for (const auto &i : vec) {
+    ser(i);
+  }
+  ser.end_array();
+}
+
+template <typename T, std::size_t N>
+void save(JsonOutputSerializer &ser, const std::array<T, N> &arr) {
+  ser.begin_array();
+  for (const auto &i : arr) {
+    ser(i);
+  }
+  ser.end_array();
+}
+
+template <typename T, std::size_t N>
+void save(JsonOutputSerializer &ser, const T (&arr)[N]) {
+  ser.begin_array();
+  for (const auto &i : arr) {
+    ser(i);
+  }
+  ser.end_array();
+}
+
+template <typename T, typename U>
+void save(JsonOutputSerializer &ser, const std::pair<T, U> &p) {
+  ser.begin_array();
+  ser(p.first);
+  ser(p.second);
+  ser.end_array();
+}
+
+template <typename T>
+void save(JsonOutputSerializer &ser, const std::optional<T> &opt) {
+  if (opt.has_value()) {
+    ser(*opt);
+  } else {
+    ser.save_null();
+  }
+}
+
+namespace detail {
+
+// JSON member names are strings: string keys are used as they are,
+// arithmetic ones spelled out. Other key types do not fit a JSON object.
+template <typename M>
+void save_json_object(JsonOutputSerializer &ser, const M &map) {
+  using K = typename M::key_type;
+  static_assert(std::is_arithmetic_v<K> ||
+                    std::is_convertible_v<const K &, std::string_view>,
+                "JSON object keys must be strings or numbers");
+  ser.begin_object();
+  for (const auto &kv : map) {
+    if constexpr (std::is_same_v<K, bool>) {
+      ser.save_key(kv.first ? "true" : "false");
+    } else if constexpr (std::is_arithmetic_v<K>) {
+      TextBuffer key;
+      key.append_number(kv.first);
+      ser.save_key(key.str());
+    } else {
+      ser.save_key(kv.first);
+    }
+    ser(kv.second);
+  }
+  ser.end_object();
+}
+
+}  // namespace detail
+
+template <typename K, typename V, typename C, typename A>
+void save(JsonOutputSerializer &ser, const std::map<K, V, C, A> &map) {
+  detail::save_json_object(ser, map);
+}
+
+template <typename K, typename V, typename H, typename E, typename A>
+void save(JsonOutputSerializer &ser,
+          const std::unordered_map<K, V, H, E, A> &map) {
+  detail::save_json_object(ser, map);
+}
+
+}  // namespace taichi
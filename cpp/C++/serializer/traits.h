@@ -1,5 +1,10 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
 namespace taichi {
 namespace traits {
 namespace detail {
@@ -19,7 +24,7 @@ struct HasMemberIo {
   template <typename...>
   static constexpr auto helper(...) -> std::false_type;
 
-  using decayed = std::decay_t<T>;
+  using decayed = std::remove_cv_t<std::remove_reference_t<T>>;
 
  public:
   using type = decltype(helper<A, decayed>(nullptr));
@@ -37,7 +42,7 @@ struct HasNonMemberIo {
   template <typename...>
   static constexpr auto helper(...) -> std::false_type;
 
-  using decayed = std::decay_t<T>;
+  using decayed = std::remove_cv_t<std::remove_reference_t<T>>;
 
  public:
   using type = decltype(helper<A, decayed>(nullptr));
@@ -54,7 +59,7 @@ struct HasNonMemberSave {
   template <typename...>
   static constexpr auto helper(...) -> std::false_type;
 
-  using decayed = std::decay_t<T>;
+  using decayed = std::remove_cv_t<std::remove_reference_t<T>>;
 
  public:
   using type = decltype(helper<S, decayed>(nullptr));
@@ -71,13 +76,47 @@ struct HasNonMemberLoad {
   template <typename...>
   static constexpr auto helper(...) -> std::false_type;
 
-  using decayed = std::decay_t<T>;
+  using decayed = std::remove_cv_t<std::remove_reference_t<T>>;
 
  public:
   using type = decltype(helper<S, decayed>(nullptr));
   static constexpr bool value = type::value;
 };
 
+// True if T's object representation can be used as its encoding, so that
+// ranges of T can be written with one memcpy: arithmetic and enum types, and
+// trivially copyable classes that are not customized through io(), save() or
+// load(). Fixed-size arrays qualify if their elements do. Note that a class
+// with pointer members also passes; those need an io() to be saved properly.
+template <typename S, typename T>
+struct IsBitwiseSerializable {
+ private:
+  using decayed = std::remove_cv_t<std::remove_reference_t<T>>;
+
+  static constexpr bool is_plain_class() {
+    if constexpr (std::is_class_v<decayed>) {
+      return std::is_trivially_copyable_v<decayed> &&
+             !HasMemberIo<S, decayed>::value &&
+             !HasNonMemberIo<S, decayed>::value &&
+             !HasNonMemberSave<S, decayed>::value &&
+             !HasNonMemberLoad<S, decayed>::value;
+    } else {
+      return false;
+    }
+  }
+
+ public:
+  static constexpr bool value = std::is_arithmetic_v<decayed> ||
+                                std::is_enum_v<decayed> || is_plain_class();
+};
+
+template <typename S, typename T, std::size_t N>
+struct IsBitwiseSerializable<S, std::array<T, N>>
+    : IsBitwiseSerializable<S, T> {};
+
+template <typename S, typename T, std::size_t N>
+struct IsBitwiseSerializable<S, T[N]> : IsBitwiseSerializable<S, T> {};
+
 inline constexpr detail::Sfinae kSfinae = {};
 
 template <bool B>
@@ -0,0 +1,813 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+template <typename T>
+using remove_cvref =
+    typename std::remove_cv<typename std::remove_reference<T>::type>;
+
+template <typename T> using remove_cvref_t = typename remove_cvref<T>::type;
+
+template <typename T, typename S> struct has_io {
+  template <typename T_>
+  static constexpr auto helper(T_ *)
+      -> std::is_same<decltype((std::declval<T_>().io(std::declval<S &>()))),
+                      void>;
+
+  template <typename> static constexpr auto helper(...) -> std::false_type;
+
+public:
+  using type_ = decltype(helper<remove_cvref_t<T>>(nullptr));
+  static constexpr bool value = type_::value;
+};
+
+template <typename T> struct IsOptional {
+  inline static constexpr bool value = false;
+};
+
+template <typename T> struct IsOptional<std::optional<T>> {
+  inline static constexpr bool value = true;
+};
+
+template <typename T> struct IsStdArray : std::false_type {};
+
+template <typename T, std::size_t n>
+struct IsStdArray<std::array<T, n>> : std::true_type {};
+
+// Types declared with TI_IO_DEF also list their fields as a tuple of
+// references, which exposes the field types at compile time.
+template <typename T, typename = void> struct has_io_fields : std::false_type {};
+
+template <typename T>
+struct has_io_fields<
+    T, std::void_t<decltype(std::declval<const T &>().ti_io_fields())>>
+    : std::true_type {};
+
+template <typename T, typename = void> struct has_reserve : std::false_type {};
+
+template <typename T>
+struct has_reserve<
+    T, std::void_t<decltype(std::declval<T &>().reserve(std::size_t{}))>>
+    : std::true_type {};
+
+template <typename S, typename T> constexpr std::size_t fixed_size();
+
+template <typename S, typename Fields> struct FixedFieldsSize;
+
+template <typename S, typename... Fs>
+struct FixedFieldsSize<S, std::tuple<Fs...>> {
+  static constexpr std::size_t value =
+      ((fixed_size<S, remove_cvref_t<Fs>>() != 0) && ...)
+          ? (fixed_size<S, remove_cvref_t<Fs>>() + ... + 0)
+          : 0;
+};
+
+// The encoded size of T under serializer S if it is the same for every value,
+// 0 otherwise. Elementary types, enums, fixed-size arrays of fixed-size
+// elements and TI_IO_DEF types whose fields all have fixed sizes qualify.
+// Such values are encoded exactly as field by field, but are written with a
+// single bounds check and straight-line stores.
+template <typename S, typename T> constexpr std::size_t fixed_size() {
+  if constexpr (std::is_enum_v<T>) {
+    return sizeof(T);
+  } else if constexpr (std::is_array_v<T>) {
+    return std::extent_v<T> * fixed_size<S, std::remove_extent_t<T>>();
+  } else if constexpr (IsStdArray<T>::value) {
+    return std::tuple_size_v<T> * fixed_size<S, typename T::value_type>();
+  } else if constexpr (has_io<T, S>::value) {
+    if constexpr (has_io_fields<T>::value) {
+      return FixedFieldsSize<
+          S, decltype(std::declval<const T &>().ti_io_fields())>::value;
+    } else {
+      return 0;
+    }
+  } else if constexpr (!std::is_pointer_v<T> && !IsOptional<T>::value &&
+                       std::is_pod_v<T>) {
+    return sizeof(T);
+  } else {
+    return 0;
+  }
+}
+
+// Pointers are saved by object identity: each distinct pointee gets an ID
+// (0 is nullptr), and only the first owning pointer (std::unique_ptr or
+// std::shared_ptr) to reach it writes the object itself. Later references,
+// and all raw pointers, write just the ID, so shared objects are stored once.
+// Raw pointers never own; their pointee must also be saved through an owning
+// pointer somewhere in the archive.
+// Identity is the address together with the static pointee type, so a
+// shared_ptr<Base> and a shared_ptr<Derived> to the same object get two IDs,
+// and the object is stored, and loaded back, twice. Save an object through
+// one pointer type only if it is to stay shared.
+class ObjectIdTable {
+public:
+  // Returns (id, true) if |ptr| still has to be written out by its owner.
+  template <typename T> std::pair<std::size_t, bool> define(const T *ptr) {
+    if (ptr == nullptr) {
+      return {0, false};
+    }
+    auto &entry = lookup(ptr);
+    const bool first = !entry.defined;
+    entry.defined = true;
+    return {entry.id, first};
+  }
+
+  template <typename T> std::size_t reference(const T *ptr) {
+    return ptr == nullptr ? 0 : lookup(ptr).id;
+  }
+
+private:
+  struct Entry {
+    std::size_t id;
+    bool defined;
+  };
+
+  struct KeyHash {
+    std::size_t
+    operator()(const std::pair<const void *, std::type_index> &key) const {
+      return std::hash<const void *>()(key.first) ^ key.second.hash_code();
+    }
+  };
+
+  // Keyed by type as well, since e.g. a struct and its first member share an
+  // address.
+  template <typename T> Entry &lookup(const T *ptr) {
+    auto [iter, inserted] = ids_.try_emplace({ptr, typeid(T)}, Entry{});
+    if (inserted) {
+      iter->second.id = ids_.size();
+    }
+    return iter->second;
+  }
+
+  std::unordered_map<std::pair<const void *, std::type_index>, Entry, KeyHash>
+      ids_;
+};
+
+class BinarySerializer {
+private:
+  using Self = BinarySerializer;
+  template <typename T>
+  inline static constexpr bool is_elementary_type_v =
+      !has_io<T, Self>::value && !std::is_pointer<T>::value &&
+      !IsOptional<T>::value && !std::is_enum_v<T> && std::is_pod_v<T>;
+
+  template <typename T, std::size_t n> using TArray = T[n];
+
+  // Ranges of elementary types are written with a single memcpy.
+  // std::vector<bool> is packed, so it stays on the per-element path.
+  template <typename T>
+  inline static constexpr bool is_bulk_range_v =
+      is_elementary_type_v<T> && !std::is_same_v<T, bool>;
+
+  template <typename T>
+  inline static constexpr std::size_t fixed_size_v = fixed_size<Self, T>();
+
+public:
+  std::vector<uint8_t> data;
+  uint8_t *c_data{nullptr};
+
+  std::size_t head{0};
+  std::size_t preserved{0};
+
+  // std::string
+  void operator()(const char *, const std::string &val) {
+    std::vector<char> val_vector(val.begin(), val.end());
+    this->operator()(nullptr, val_vector);
+  }
+
+  // C-array
+  template <typename T, std::size_t n>
+  void operator()(const char *, const TArray<T, n> &val) {
+    if constexpr (is_bulk_range_v<T>) {
+      write_bytes(val, sizeof(val));
+    } else if constexpr (fixed_size_v<TArray<T, n>> > 0) {
+      store_fixed(claim_bytes(fixed_size_v<TArray<T, n>>), val);
+    } else {
+      for (std::size_t i = 0; i < n; i++) {
+        this->operator()("", val[i]);
+      }
+    }
+  }
+
+  // std::array
+  template <typename T, std::size_t n>
+  void operator()(const char *, const std::array<T, n> &val) {
+    if constexpr (is_bulk_range_v<T>) {
+      write_bytes(val.data(), sizeof(val));
+    } else if constexpr (fixed_size_v<std::array<T, n>> > 0) {
+      store_fixed(claim_bytes(fixed_size_v<std::array<T, n>>), val);
+    } else {
+      for (std::size_t i = 0; i < n; i++) {
+        this->operator()("", val[i]);
+      }
+    }
+  }
+
+  // Elementary data types
+  template <typename T>
+  typename std::enable_if<is_elementary_type_v<T>, void>::type
+  operator()(const char *, const T &val) {
+    static_assert(!std::is_reference<T>::value, "T cannot be reference");
+    static_assert(!std::is_const<T>::value, "T cannot be const");
+    static_assert(!std::is_volatile<T>::value, "T cannot be volatile");
+    static_assert(!std::is_pointer<T>::value, "T cannot be pointer");
+    static_assert(std::is_pod_v<T>, "not pod");
+    write_bytes(&val, sizeof(T));
+  }
+
+  template <typename T>
+  typename std::enable_if<has_io<T, Self>::value, void>::type
+  operator()(const char *, const T &val) {
+    if constexpr (fixed_size_v<T> > 0) {
+      store_fixed(claim_bytes(fixed_size_v<T>), val);
+    } else {
+      val.io(*this);
+    }
+  }
+
+  // Unique Pointers to non-taichi-unit Types
+  template <typename T>
+  void operator()(const char *, const std::unique_ptr<T> &val) {
+    handle_owning_pointer(val.get());
+  }
+
+  // Shared Pointers
+  template <typename T>
+  void operator()(const char *, const std::shared_ptr<T> &val) {
+    handle_owning_pointer(val.get());
+  }
+
+  // Raw pointers (no ownership)
+  template <typename T>
+  typename std::enable_if<std::is_pointer<T>::value, void>::type
+  operator()(const char *, const T &val) {
+    this->operator()("", object_ids_.reference(val));
+  }
+
+  // enum class
+  template <typename T>
+  typename std::enable_if<std::is_enum_v<T>, void>::type
+  operator()(const char *, const T &val) {
+    using UT = std::underlying_type_t<T>;
+    // https://stackoverflow.com/a/62688905/12003165
+    this->operator()(nullptr, static_cast<UT>(val));
+  }
+
+  // std::vector
+  template <typename T>
+  void operator()(const char *, const std::vector<T> &val) {
+    this->operator()("", val.size());
+    if constexpr (is_bulk_range_v<T>) {
+      write_bytes(val.data(), val.size() * sizeof(T));
+    } else if constexpr (fixed_size_v<T> > 0 && !std::is_same_v<T, bool>) {
+      // A packed array of fixed-size records.
+      uint8_t *dst = claim_bytes(val.size() * fixed_size_v<T>);
+      for (const auto &v : val) {
+        dst = store_fixed(dst, v);
+      }
+    } else {
+      for (std::size_t i = 0; i < val.size(); i++) {
+        this->operator()("", val[i]);
+      }
+    }
+  }
+
+  // std::pair
+  template <typename T, typename G>
+  void operator()(const char *, const std::pair<T, G> &val) {
+    this->operator()(nullptr, val.first);
+    this->operator()(nullptr, val.second);
+  }
+
+  // std::map
+  template <typename K, typename V>
+  void operator()(const char *, const std::map<K, V> &val) {
+    handle_associative_container(val);
+  }
+
+  // std::unordered_map
+  template <typename K, typename V>
+  void operator()(const char *, const std::unordered_map<K, V> &val) {
+    handle_associative_container(val);
+  }
+
+  // std::optional
+  template <typename T>
+  void operator()(const char *, const std::optional<T> &val) {
+    this->operator()(nullptr, val.has_value());
+    if (val.has_value()) {
+      this->operator()(nullptr, val.value());
+    }
+  }
+
+  template <typename T, typename... Args>
+  void HHH(const char *, const T &t, Args &&... rest) {
+    this->operator()(nullptr, t);
+    if constexpr (sizeof...(rest) > 0) {
+      this->HHH(nullptr, std::forward<Args>(rest)...);
+    }
+  }
+
+  template <typename T> void HHH(const T &val) { this->HHH(nullptr, val); }
+
+private:
+  template <typename T> void handle_owning_pointer(const T *ptr) {
+    const auto [id, first] = object_ids_.define(ptr);
+    this->operator()("", id);
+    if (first) {
+      this->operator()("", *ptr);
+    }
+  }
+
+  void write_bytes(const void *src, std::size_t size) {
+    std::size_t new_size = head + size;
+    if (c_data) {
+      std::memcpy(&c_data[head], src, size);
+    } else {
+      data.resize(new_size);
+      std::memcpy(&data[head], src, size);
+    }
+
+    head += size;
+  }
+
+  // Makes room for |size| bytes at |head| and returns where they go.
+  uint8_t *claim_bytes(std::size_t size) {
+    uint8_t *dst = nullptr;
+    if (c_data) {
+      dst = c_data + head;
+    } else {
+      data.resize(head + size);
+      dst = data.data() + head;
+    }
+    head += size;
+    return dst;
+  }
+
+  // Writes |val|, which has a fixed size, at |dst| without bounds checks and
+  // returns the end of it.
+  template <typename T> static uint8_t *store_fixed(uint8_t *dst, const T &val) {
+    if constexpr (std::is_enum_v<T>) {
+      const auto v = static_cast<std::underlying_type_t<T>>(val);
+      std::memcpy(dst, &v, sizeof(v));
+      return dst + sizeof(v);
+    } else if constexpr (std::is_array_v<T> || IsStdArray<T>::value) {
+      if constexpr (is_bulk_range_v<remove_cvref_t<decltype(val[0])>>) {
+        std::memcpy(dst, &val, sizeof(val));
+        return dst + sizeof(val);
+      } else {
+        for (const auto &v : val) {
+          dst = store_fixed(dst, v);
+        }
+        return dst;
+      }
+    } else if constexpr (has_io<T, Self>::value) {
+      std::apply(
+          [&dst](const auto &... fields) {
+            ((dst = store_fixed(dst, fields)), ...);
+          },
+          val.ti_io_fields());
+      return dst;
+    } else {
+      std::memcpy(dst, &val, sizeof(T));
+      return dst + sizeof(T);
+    }
+  }
+
+  // Maps of elementary keys and values are written as two packed arrays,
+  // all keys and then all values.
+  template <typename M> void handle_associative_container(const M &val) {
+    using K = typename M::key_type;
+    using V = typename M::mapped_type;
+    this->operator()(nullptr, val.size());
+    if constexpr (is_bulk_range_v<K> && is_bulk_range_v<V>) {
+      uint8_t *keys = claim_bytes(val.size() * (sizeof(K) + sizeof(V)));
+      uint8_t *values = keys + val.size() * sizeof(K);
+      for (const auto &kv : val) {
+        std::memcpy(keys, &kv.first, sizeof(K));
+        std::memcpy(values, &kv.second, sizeof(V));
+        keys += sizeof(K);
+        values += sizeof(V);
+      }
+    } else {
+      for (const auto &kv : val) {
+        this->operator()(nullptr, kv.first);
+        this->operator()(nullptr, kv.second);
+      }
+    }
+  }
+
+  ObjectIdTable object_ids_;
+};
+
+// Reads back what BinarySerializer wrote. io() is const (see TI_IO_DEF), so
+// fields arrive as const references and are written through const_cast.
+//
+// Raw pointers may refer to objects whose owner comes later in the archive;
+// they are patched in finish(), which must be called once loading is done.
+class BinaryDeserializer {
+private:
+  using Self = BinaryDeserializer;
+  template <typename T>
+  inline static constexpr bool is_elementary_type_v =
+      !has_io<T, Self>::value && !std::is_pointer<T>::value &&
+      !IsOptional<T>::value && !std::is_enum_v<T> && std::is_pod_v<T>;
+
+  template <typename T, std::size_t n> using TArray = T[n];
+
+  template <typename T>
+  inline static constexpr bool is_bulk_range_v =
+      is_elementary_type_v<T> && !std::is_same_v<T, bool>;
+
+  template <typename T>
+  inline static constexpr std::size_t fixed_size_v = fixed_size<Self, T>();
+
+  template <typename T> static T &mut(const T &val) {
+    return const_cast<T &>(val);
+  }
+
+public:
+  BinaryDeserializer(const uint8_t *data, std::size_t size)
+      : c_data(data), size(size) {}
+  explicit BinaryDeserializer(const std::vector<uint8_t> &data)
+      : BinaryDeserializer(data.data(), data.size()) {}
+
+  const uint8_t *c_data;
+  std::size_t size;
+  std::size_t head{0};
+
+  // std::string
+  void operator()(const char *, const std::string &val) {
+    std::vector<char> val_vector;
+    this->operator()(nullptr, val_vector);
+    mut(val).assign(val_vector.begin(), val_vector.end());
+  }
+
+  // C-array
+  template <typename T, std::size_t n>
+  void operator()(const char *, const TArray<T, n> &val) {
+    if constexpr (is_bulk_range_v<T>) {
+      read_bytes(mut(val), sizeof(val));
+    } else if constexpr (fixed_size_v<TArray<T, n>> > 0) {
+      load_fixed(take_bytes(fixed_size_v<TArray<T, n>>), val);
+    } else {
+      for (std::size_t i = 0; i < n; i++) {
+        this->operator()("", val[i]);
+      }
+    }
+  }
+
+  // std::array
+  template <typename T, std::size_t n>
+  void operator()(const char *, const std::array<T, n> &val) {
+    if constexpr (is_bulk_range_v<T>) {
+      read_bytes(mut(val).data(), sizeof(val));
+    } else if constexpr (fixed_size_v<std::array<T, n>> > 0) {
+      load_fixed(take_bytes(fixed_size_v<std::array<T, n>>), val);
+    } else {
+      for (std::size_t i = 0; i < n; i++) {
+        this->operator()("", val[i]);
+      }
+    }
+  }
+
+  // Elementary data types
+  template <typename T>
+  typename std::enable_if<is_elementary_type_v<T>, void>::type
+  operator()(const char *, const T &val) {
+    read_bytes(&mut(val), sizeof(T));
+  }
+
+  template <typename T>
+  typename std::enable_if<has_io<T, Self>::value, void>::type
+  operator()(const char *, const T &val) {
+    if constexpr (fixed_size_v<T> > 0) {
+      load_fixed(take_bytes(fixed_size_v<T>), val);
+    } else {
+      val.io(*this);
+    }
+  }
+
+  // Unique Pointers to non-taichi-unit Types
+  template <typename T>
+  void operator()(const char *, const std::unique_ptr<T> &val) {
+    std::size_t id = 0;
+    this->operator()("", id);
+    if (id == 0) {
+      mut(val).reset();
+      return;
+    }
+    auto &entry = entry_at(id);
+    if (entry.raw != nullptr) {
+      throw std::runtime_error("object has more than one unique owner");
+    }
+    auto ptr = std::make_unique<T>();
+    entry.raw = ptr.get();
+    entry.type = typeid(T);
+    this->operator()("", *ptr);
+    mut(val) = std::move(ptr);
+  }
+
+  // Shared Pointers
+  template <typename T>
+  void operator()(const char *, const std::shared_ptr<T> &val) {
+    std::size_t id = 0;
+    this->operator()("", id);
+    if (id == 0) {
+      mut(val).reset();
+      return;
+    }
+    auto &entry = entry_at(id);
+    if (entry.raw == nullptr) {
+      auto ptr = std::make_shared<T>();
+      entry.raw = ptr.get();
+      entry.shared = ptr;
+      entry.type = typeid(T);
+      this->operator()("", *ptr);
+      mut(val) = std::move(ptr);
+    } else if (entry.shared == nullptr) {
+      throw std::runtime_error("object is both uniquely and shared owned");
+    } else {
+      check_type(entry, typeid(T));
+      mut(val) = std::static_pointer_cast<T>(entry.shared);
+    }
+  }
+
+  // Raw pointers (no ownership)
+  template <typename T>
+  typename std::enable_if<std::is_pointer<T>::value, void>::type
+  operator()(const char *, const T &val) {
+    using Pointee = std::remove_pointer_t<T>;
+    std::size_t id = 0;
+    this->operator()("", id);
+    if (id == 0) {
+      mut(val) = nullptr;
+      return;
+    }
+    check_id(id);
+    if (id <= objects_.size() && objects_[id - 1].raw != nullptr) {
+      check_type(objects_[id - 1], typeid(Pointee));
+      mut(val) = static_cast<T>(objects_[id - 1].raw);
+    } else {
+      auto *slot = &mut(val);
+      fixups_.push_back({id, typeid(Pointee),
+                         [slot](void *p) { *slot = static_cast<T>(p); }});
+    }
+  }
+
+  // enum class
+  template <typename T>
+  typename std::enable_if<std::is_enum_v<T>, void>::type
+  operator()(const char *, const T &val) {
+    using UT = std::underlying_type_t<T>;
+    UT v;
+    this->operator()(nullptr, v);
+    mut(val) = static_cast<T>(v);
+  }
+
+  // std::vector
+  template <typename T>
+  void operator()(const char *, const std::vector<T> &val) {
+    std::size_t n = 0;
+    this->operator()("", n);
+    auto &vec = mut(val);
+    if constexpr (fixed_size_v<T> > 0 && !is_bulk_range_v<T> &&
+                  !std::is_same_v<T, bool>) {
+      // One bounds check for the whole packed array.
+      if (n > (size - head) / fixed_size_v<T>) {
+        throw std::out_of_range("read past end of archive");
+      }
+      vec.resize(n);
+      const uint8_t *src = take_bytes(n * fixed_size_v<T>);
+      for (auto &v : vec) {
+        src = load_fixed(src, v);
+      }
+      return;
+    }
+    vec.resize(n);
+    if constexpr (is_bulk_range_v<T>) {
+      read_bytes(vec.data(), n * sizeof(T));
+    } else if constexpr (std::is_same_v<T, bool>) {
+      // The elements are proxies, which do not bind to const bool &.
+      for (std::size_t i = 0; i < n; i++) {
+        bool b = false;
+        this->operator()("", b);
+        vec[i] = b;
+      }
+    } else {
+      for (std::size_t i = 0; i < n; i++) {
+        this->operator()("", vec[i]);
+      }
+    }
+  }
+
+  // std::pair
+  template <typename T, typename G>
+  void operator()(const char *, const std::pair<T, G> &val) {
+    this->operator()(nullptr, val.first);
+    this->operator()(nullptr, val.second);
+  }
+
+  // std::map
+  template <typename K, typename V>
+  void operator()(const char *, const std::map<K, V> &val) {
+    handle_associative_container(mut(val));
+  }
+
+  // std::unordered_map
+  template <typename K, typename V>
+  void operator()(const char *, const std::unordered_map<K, V> &val) {
+    handle_associative_container(mut(val));
+  }
+
+  // std::optional
+  template <typename T>
+  void operator()(const char *, const std::optional<T> &val) {
+    bool has_value = false;
+    this->operator()(nullptr, has_value);
+    auto &opt = mut(val);
+    if (has_value) {
+      this->operator()(nullptr, opt.emplace());
+    } else {
+      opt.reset();
+    }
+  }
+
+  template <typename T, typename... Args>
+  void HHH(const char *, const T &t, Args &&... rest) {
+    this->operator()(nullptr, t);
+    if constexpr (sizeof...(rest) > 0) {
+      this->HHH(nullptr, std::forward<Args>(rest)...);
+    }
+  }
+
+  template <typename T> void HHH(const T &val) { this->HHH(nullptr, val); }
+
+  // Points raw pointers at objects that were loaded after them.
+  void finish() {
+    for (const auto &fixup : fixups_) {
+      if (fixup.id > objects_.size() || objects_[fixup.id - 1].raw == nullptr) {
+        throw std::runtime_error("raw pointer to an object with no owner");
+      }
+      check_type(objects_[fixup.id - 1], fixup.type);
+      fixup.patch(objects_[fixup.id - 1].raw);
+    }
+    fixups_.clear();
+  }
+
+private:
+  // |type| is what the object was created as; the archive only has its ID,
+  // so every later pointer to it is checked against that before the cast.
+  struct Entry {
+    void *raw{nullptr};
+    std::shared_ptr<void> shared;
+    std::type_index type{typeid(void)};
+  };
+
+  struct Fixup {
+    std::size_t id;
+    std::type_index type;
+    std::function<void(void *)> patch;
+  };
+
+  // IDs are handed out in the order pointees are first reached while
+  // saving, so each one is at most one past the largest seen before it.
+  // Anything larger is corrupt, and is rejected before objects_ grows to it.
+  void check_id(std::size_t id) {
+    if (id > max_id_ + 1) {
+      throw std::out_of_range("object id out of range");
+    }
+    max_id_ = std::max(max_id_, id);
+  }
+
+  static void check_type(const Entry &entry, std::type_index type) {
+    if (entry.type != type) {
+      throw std::runtime_error("object loaded as two different types");
+    }
+  }
+
+  Entry &entry_at(std::size_t id) {
+    check_id(id);
+    if (id > objects_.size()) {
+      objects_.resize(id);
+    }
+    return objects_[id - 1];
+  }
+
+  void read_bytes(void *dst, std::size_t n) {
+    if (n > size - head) {
+      throw std::out_of_range("read past end of archive");
+    }
+    std::memcpy(dst, &c_data[head], n);
+    head += n;
+  }
+
+  // Consumes |n| bytes and returns where they start.
+  const uint8_t *take_bytes(std::size_t n) {
+    if (n > size - head) {
+      throw std::out_of_range("read past end of archive");
+    }
+    const uint8_t *src = c_data + head;
+    head += n;
+    return src;
+  }
+
+  // Reads |val|, which has a fixed size, from |src| without bounds checks and
+  // returns the end of it.
+  template <typename T>
+  static const uint8_t *load_fixed(const uint8_t *src, const T &val) {
+    if constexpr (std::is_enum_v<T>) {
+      std::underlying_type_t<T> v;
+      std::memcpy(&v, src, sizeof(v));
+      mut(val) = static_cast<T>(v);
+      return src + sizeof(v);
+    } else if constexpr (std::is_array_v<T> || IsStdArray<T>::value) {
+      if constexpr (is_bulk_range_v<remove_cvref_t<decltype(val[0])>>) {
+        std::memcpy(&mut(val), src, sizeof(val));
+        return src + sizeof(val);
+      } else {
+        for (const auto &v : val) {
+          src = load_fixed(src, v);
+        }
+        return src;
+      }
+    } else if constexpr (has_io<T, Self>::value) {
+      std::apply(
+          [&src](const auto &... fields) {
+            ((src = load_fixed(src, fields)), ...);
+          },
+          val.ti_io_fields());
+      return src;
+    } else {
+      std::memcpy(&mut(val), src, sizeof(T));
+      return src + sizeof(T);
+    }
+  }
+
+  // Entries arrive in the order they were saved, which for std::map is
+  // sorted, so each one is inserted with end() as the hint.
+  template <typename M> void handle_associative_container(M &val) {
+    using K = typename M::key_type;
+    using V = typename M::mapped_type;
+    std::size_t n = 0;
+    this->operator()(nullptr, n);
+    val.clear();
+    if constexpr (is_bulk_range_v<K> && is_bulk_range_v<V>) {
+      if (n > (size - head) / (sizeof(K) + sizeof(V))) {
+        throw std::out_of_range("read past end of archive");
+      }
+      if constexpr (has_reserve<M>::value) {
+        val.reserve(n);
+      }
+      const uint8_t *keys = take_bytes(n * (sizeof(K) + sizeof(V)));
+      const uint8_t *values = keys + n * sizeof(K);
+      for (std::size_t i = 0; i < n; i++) {
+        K key;
+        V value;
+        std::memcpy(&key, keys + i * sizeof(K), sizeof(K));
+        std::memcpy(&value, values + i * sizeof(V), sizeof(V));
+        val.emplace_hint(val.end(), key, value);
+      }
+      return;
+    }
+    if constexpr (has_reserve<M>::value) {
+      // Every entry takes at least a byte, which bounds a corrupt count.
+      val.reserve(std::min(n, size - head));
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      K key;
+      V value;
+      this->operator()(nullptr, key);
+      this->operator()(nullptr, value);
+      val.emplace_hint(val.end(), std::move(key), std::move(value));
+    }
+  }
+
+  // Indexed by ID - 1.
+  std::vector<Entry> objects_;
+  std::vector<Fixup> fixups_;
+  std::size_t max_id_{0};
+};
+
+#define TI_IO(...)                                                             \
+  { serializer.HHH(#__VA_ARGS__, __VA_ARGS__); }
+
+// Also lists the fields for fixed_size().
+#define TI_IO_DEF(...)                                                         \
+  template <typename S> void io(S &serializer) const { TI_IO(__VA_ARGS__) }   \
+  auto ti_io_fields() const { return std::tie(__VA_ARGS__); }